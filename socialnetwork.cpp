@@ -4,22 +4,194 @@
 #include <fstream>
 #include <sstream> // Required for std::ostringstream
 #include <map>
+#include <set>
 #include <algorithm>
-#include <ctime>   // Required for std::time, std::localtime, std::strftime, std::time_t
+#include <iterator> // Required for std::back_inserter
+#include <queue>   // Required for std::priority_queue
+#include <ctime>   // Required for std::localtime, std::strftime, std::mktime, std::time_t
+#include <chrono>  // Required for std::chrono::system_clock
 #include <limits>  // Required for numeric_limits
 #include <cstddef> // Required for NULL
+#include <cstdio>  // Required for std::rename, std::remove, std::sscanf
+#include <cstdlib> // Required for std::strtoll
+#include <cmath>   // Required for std::pow
+#include <thread>  // Required for background journal compaction
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <memory>  // Required for std::shared_ptr
+#include <future>  // Required for std::shared_future (journal durability)
+#include <stdint.h> // Required for uint32_t (<cstdint> is missing on some older compilers)
+#include <cstring> // Required for std::memcpy
+#ifndef _WIN32
+#include <fcntl.h>    // Required for open
+#include <sys/mman.h> // Required for mmap
+#include <sys/stat.h> // Required for fstat, mkdir
+#include <sys/resource.h> // Required for getrusage (benchmark mode)
+#include <unistd.h>   // Required for close
+#include <pthread.h>  // Required for pthread_rwlock_t
+#else
+#include <io.h>       // Required for _commit
+#endif
+#ifdef __linux__
+#include <cerrno>
+#include <csignal>
+#include <sys/epoll.h>   // Server mode event loop
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#endif
 
 // --- Helper Functions ---
 
-// Function to get current timestamp as a string
-std::string getCurrentTimestamp() {
-    std::time_t now = std::time(NULL); // Replaced nullptr with NULL
+// Post timestamps are microseconds since the Unix epoch (UTC). They are only formatted for display.
+typedef int64_t Timestamp;
+
+// Highest timestamp handed out or loaded so far, so new posts always sort after existing ones
+std::atomic<Timestamp> lastTimestamp(0);
+
+// Records a timestamp seen on disk, so later calls to nextTimestamp() return something greater
+void observeTimestamp(Timestamp timestamp) {
+    Timestamp last = lastTimestamp.load();
+    while (timestamp > last && !lastTimestamp.compare_exchange_weak(last, timestamp)) {
+    }
+}
+
+// The wall clock as a Timestamp
+Timestamp currentTime() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+// Function to get the timestamp for a new post: the current time, bumped by a microsecond if needed
+// so that every post gets a distinct, increasing timestamp even within the same clock tick
+Timestamp nextTimestamp() {
+    Timestamp now = currentTime();
+    Timestamp last = lastTimestamp.load();
+    Timestamp next;
+    do {
+        next = std::max(now, last + 1);
+    } while (!lastTimestamp.compare_exchange_weak(last, next));
+    return next;
+}
+
+// Function to format a timestamp in local time for display, e.g. "2024-05-01 13:37:00"
+std::string formatTimestamp(Timestamp timestamp) {
+    std::time_t seconds = static_cast<std::time_t>(timestamp / 1000000);
+    std::tm local;
+#ifdef _WIN32
+    localtime_s(&local, &seconds);
+#else
+    localtime_r(&seconds, &local); // std::localtime is not thread-safe
+#endif
     char buf[100];
-    // Use std::localtime and std::strftime for formatting the time
-    std::strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", std::localtime(&now));
+    std::strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", &local);
     return buf;
 }
 
+// Function to read a timestamp from a file: microseconds since the epoch, or the
+// "YYYY-MM-DD HH:MM:SS" local time strings written by older versions (returns 0 if neither)
+Timestamp parseTimestamp(const std::string& str) {
+    if (!str.empty() && str.find_first_not_of("0123456789") == std::string::npos) {
+        return std::strtoll(str.c_str(), NULL, 10);
+    }
+    std::tm local = std::tm();
+    if (std::sscanf(str.c_str(), "%d-%d-%d %d:%d:%d", &local.tm_year, &local.tm_mon, &local.tm_mday,
+                    &local.tm_hour, &local.tm_min, &local.tm_sec) != 6) {
+        return 0;
+    }
+    local.tm_year -= 1900;
+    local.tm_mon -= 1;
+    local.tm_isdst = -1; // Let mktime work out daylight saving time
+    return static_cast<Timestamp>(std::mktime(&local)) * 1000000;
+}
+
+// Function to convert an integer to a string (more compatible than std::to_string for some compilers)
+std::string toString(int64_t value) {
+    std::ostringstream oss;
+    oss << value;
+    return oss.str();
+}
+
+// Post IDs are numbers (see PostIdGenerator); the text files and the journal write them as "post_<id>"
+std::string formatPostId(uint64_t id) {
+    char buf[32];
+    int length = std::snprintf(buf, sizeof(buf), "post_%llu", static_cast<unsigned long long>(id));
+    return std::string(buf, length);
+}
+
+// Parses "post_<id>" (or a bare number). Returns 0 for anything else.
+uint64_t parsePostId(const char* data, size_t length) {
+    if (length > 5 && std::memcmp(data, "post_", 5) == 0) {
+        data += 5;
+        length -= 5;
+    }
+    if (length == 0 || length > 19) {
+        return 0;
+    }
+    uint64_t id = 0;
+    for (size_t i = 0; i < length; ++i) {
+        if (data[i] < '0' || data[i] > '9') {
+            return 0;
+        }
+        id = id * 10 + static_cast<uint64_t>(data[i] - '0');
+    }
+    return id;
+}
+
+uint64_t parsePostId(const std::string& str) {
+    return parsePostId(str.data(), str.size());
+}
+
+// Snowflake-style post IDs: milliseconds since POST_ID_EPOCH_MS in the top 41 bits, then 10 bits of
+// shard and a 12-bit sequence within the millisecond. IDs from every shard sort by creation time;
+// the counters older versions used (1, 2, 3, ...) sort before all of them.
+const int POST_ID_SHARD_BITS = 10;
+const int POST_ID_SEQUENCE_BITS = 12;
+const uint64_t POST_ID_EPOCH_MS = 1704067200000ull; // 2024-01-01 00:00:00 UTC
+
+// Hands out increasing post IDs without a lock: one compare-and-swap on the last (milliseconds,
+// sequence) pair. When the sequence of a millisecond runs out, or the clock steps back, IDs
+// borrow from the following milliseconds, like nextTimestamp() does.
+class PostIdGenerator {
+private:
+    std::atomic<uint64_t> last; // Milliseconds << POST_ID_SEQUENCE_BITS | sequence of the newest ID
+    uint64_t shard;
+
+public:
+    PostIdGenerator() : last(0), shard(0) {}
+
+    void setShard(uint32_t shardId) {
+        shard = shardId & ((1u << POST_ID_SHARD_BITS) - 1);
+    }
+
+    uint64_t next() {
+        uint64_t millis = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count());
+        uint64_t now = (millis > POST_ID_EPOCH_MS ? millis - POST_ID_EPOCH_MS : 0) << POST_ID_SEQUENCE_BITS;
+        uint64_t previous = last.load();
+        uint64_t next;
+        do {
+            next = std::max(now, previous + 1);
+        } while (!last.compare_exchange_weak(previous, next));
+        uint64_t sequenceMask = (1u << POST_ID_SEQUENCE_BITS) - 1;
+        return (next >> POST_ID_SEQUENCE_BITS) << (POST_ID_SHARD_BITS + POST_ID_SEQUENCE_BITS)
+               | shard << POST_ID_SEQUENCE_BITS | (next & sequenceMask);
+    }
+
+    // Records an ID loaded from disk (from any shard), so later IDs are greater: they continue in
+    // the millisecond after it
+    void observe(uint64_t id) {
+        uint64_t floor = ((id >> (POST_ID_SHARD_BITS + POST_ID_SEQUENCE_BITS)) + 1) << POST_ID_SEQUENCE_BITS;
+        uint64_t previous = last.load();
+        while (floor - 1 > previous && !last.compare_exchange_weak(previous, floor - 1)) {
+        }
+    }
+};
+
 // Function to sanitize string for file storage (replace delimiters)
 // This prevents issues when reading data back using '|' as a delimiter.
 std::string sanitizeString(const std::string& str) {
@@ -37,25 +209,248 @@ std::string desanitizeString(const std::string& str) {
     return str;
 }
 
+// Dense integer handle for a user: the index of the user in SocialNetwork::users.
+// Friendships, posts and feeds refer to users by ID so names are stored exactly once.
+typedef uint32_t UserId;
+const UserId NO_USER = 0xFFFFFFFFu;
+
+// Handle for a post: its index in SocialNetwork::posts. Posts are only ever appended,
+// so handles grow with posting order and double as "older than" pagination cursors.
+typedef uint32_t PostHandle;
+const PostHandle NO_POST = 0xFFFFFFFFu; // "No cursor": start from the newest post
+
+const size_t PROFILE_PAGE_SIZE = 10; // Posts shown per profile page
+const size_t FEED_PAGE_SIZE = 20; // Posts shown per feed page
+const size_t MAX_POST_LENGTH = 255; // Longer posts are truncated
+const size_t SUGGESTION_COUNT = 10; // Friend suggestions shown
+const uint64_t SUGGESTION_EDGE_BUDGET = 1 << 16; // Friend-of-friend edges visited before sampling kicks in
+const size_t SUGGESTION_RERANK_FACTOR = 8; // Sampled candidates re-counted exactly, per suggestion shown
+const int GRAPH_SNAPSHOT_ATTEMPTS = 3; // Copies of the friendship graph tried before one racing changes is used
+
+// Outcome of a SocialNetwork operation, shared by the interactive menu and batch mode
+enum OpStatus {
+    OP_OK,
+    OP_INVALID_ARGUMENT,
+    OP_USER_EXISTS,
+    OP_NO_SUCH_USER,
+    OP_BAD_CREDENTIALS,
+    OP_SELF_FRIEND,
+    OP_ALREADY_FRIENDS,
+    OP_NOT_FRIENDS,
+    OP_NOT_LOGGED_IN,
+    OP_FORBIDDEN,
+    OP_IO_ERROR,
+    OP_WRONG_SHARD,        // The user belongs to another shard of a sharded network
+    OP_UNSUPPORTED,        // Not available through the shard router
+    OP_SHARD_UNAVAILABLE   // The router could not reach a shard
+};
+
+// Machine-readable name of a status, as printed by batch mode
+const char* opStatusName(OpStatus status) {
+    switch (status) {
+    case OP_OK: return "ok";
+    case OP_INVALID_ARGUMENT: return "invalid_argument";
+    case OP_USER_EXISTS: return "user_exists";
+    case OP_NO_SUCH_USER: return "no_such_user";
+    case OP_BAD_CREDENTIALS: return "bad_credentials";
+    case OP_SELF_FRIEND: return "self_friend";
+    case OP_ALREADY_FRIENDS: return "already_friends";
+    case OP_NOT_FRIENDS: return "not_friends";
+    case OP_NOT_LOGGED_IN: return "not_logged_in";
+    case OP_FORBIDDEN: return "forbidden";
+    case OP_IO_ERROR: return "io_error";
+    case OP_WRONG_SHARD: return "wrong_shard";
+    case OP_UNSUPPORTED: return "unsupported";
+    case OP_SHARD_UNAVAILABLE: return "shard_unavailable";
+    }
+    return "unknown";
+}
+
+// Usernames and passwords are single words that can be stored between '|' delimiters
+bool validToken(const std::string& str) {
+    return !str.empty() && str.find_first_of("| \t\r\n") == std::string::npos;
+}
+
+// 32-bit FNV-1a hash, used by the username index
+uint32_t hashString(const char* data, size_t length) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; ++i) {
+        hash ^= static_cast<unsigned char>(data[i]);
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+uint32_t hashString(const std::string& str) {
+    return hashString(str.data(), str.size());
+}
+
+// 64-bit FNV-1a hash, for keys counted in sketches where 32 bits would collide too often
+uint64_t hashString64(const std::string& str) {
+    uint64_t hash = 14695981039346656037ull;
+    for (size_t i = 0; i < str.size(); ++i) {
+        hash ^= static_cast<unsigned char>(str[i]);
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+// Shard that owns a user when the network is split across 'shardCount' processes
+uint32_t shardOfUser(const std::string& username, uint32_t shardCount) {
+    return hashString(username) % shardCount;
+}
+
+// --- String Arena ---
+
+// Location of a string stored in a StringArena: 12 bytes in place of a std::string and its heap block
+struct ArenaString {
+    uint32_t block;
+    uint32_t offset;
+    uint32_t length;
+
+    ArenaString() : block(0), offset(0), length(0) {}
+    ArenaString(uint32_t block, uint32_t offset, uint32_t length) : block(block), offset(offset), length(length) {}
+};
+
+// Read-only copy of an arena's block list. Appends never move or modify bytes already stored, so
+// a view stays valid while the arena keeps growing (until the arena is cleared).
+class ArenaView {
+private:
+    std::vector<const char*> blocks;
+
+public:
+    ArenaView() {}
+    explicit ArenaView(const std::vector<const char*>& blocks) : blocks(blocks) {}
+
+    const char* data(const ArenaString& str) const {
+        return str.length == 0 ? "" : blocks[str.block] + str.offset;
+    }
+
+    std::string str(const ArenaString& str) const {
+        return std::string(data(str), str.length);
+    }
+};
+
+// Append-only string storage in large blocks. Replaces millions of small heap allocations (and
+// their allocator overhead) with a few big ones; strings are addressed by ArenaString.
+// Besides its own blocks, the arena can address external ones (bytes of a mapped file it does not
+// own), so strings can live on disk and in memory behind the same ArenaString.
+class StringArena {
+private:
+    static const size_t BLOCK_SIZE = 1024 * 1024;
+    std::vector<const char*> blocks; // Own and external blocks, indexed by ArenaString::block
+    std::vector<char*> owned;        // The blocks to free
+    size_t current;       // Index of the block appends go to
+    size_t used;          // Bytes taken in the current block
+    size_t lastCapacity;  // Size of the current block (larger than BLOCK_SIZE for an oversized string)
+    uint64_t reserved;    // Bytes allocated over all own blocks
+
+    StringArena(const StringArena&); // Not copyable
+    StringArena& operator=(const StringArena&);
+
+public:
+    StringArena() : current(0), used(0), lastCapacity(0), reserved(0) {}
+    ~StringArena() { clear(); }
+
+    ArenaString append(const char* data, size_t length) {
+        ArenaString str;
+        if (length == 0) {
+            return str;
+        }
+        if (owned.empty() || used + length > lastCapacity) {
+            lastCapacity = std::max(BLOCK_SIZE, length);
+            owned.push_back(new char[lastCapacity]);
+            current = blocks.size();
+            blocks.push_back(owned.back());
+            reserved += lastCapacity;
+            used = 0;
+        }
+        std::memcpy(owned.back() + used, data, length);
+        str.block = static_cast<uint32_t>(current);
+        str.offset = static_cast<uint32_t>(used);
+        str.length = static_cast<uint32_t>(length);
+        used += length;
+        return str;
+    }
+
+    ArenaString append(const std::string& str) {
+        return append(str.data(), str.size());
+    }
+
+    // Registers bytes the arena does not own (they must outlive it, or the next clear()) and returns
+    // the block number to address them with
+    uint32_t addExternal(const char* data) {
+        blocks.push_back(data);
+        return static_cast<uint32_t>(blocks.size() - 1);
+    }
+
+    const char* data(const ArenaString& str) const {
+        return str.length == 0 ? "" : blocks[str.block] + str.offset;
+    }
+
+    std::string str(const ArenaString& str) const {
+        return std::string(data(str), str.length);
+    }
+
+    ArenaView view() const {
+        return ArenaView(blocks);
+    }
+
+    // Heap bytes; external blocks are not counted
+    uint64_t memoryBytes() const {
+        return reserved + blocks.capacity() * sizeof(char*) + owned.capacity() * sizeof(char*);
+    }
+
+    void swap(StringArena& other) {
+        blocks.swap(other.blocks);
+        owned.swap(other.owned);
+        std::swap(current, other.current);
+        std::swap(used, other.used);
+        std::swap(lastCapacity, other.lastCapacity);
+        std::swap(reserved, other.reserved);
+    }
+
+    // Frees every block; all ArenaStrings and views into the arena become invalid
+    void clear() {
+        for (size_t i = 0; i < owned.size(); ++i) {
+            delete[] owned[i];
+        }
+        blocks.clear();
+        owned.clear();
+        current = 0;
+        used = 0;
+        lastCapacity = 0;
+        reserved = 0;
+    }
+};
+
+const size_t StringArena::BLOCK_SIZE; // Defined here too: std::max takes it by reference
+
 // --- User Class ---
 class User {
 public:
     std::string username;
     std::string password;
-    std::string bio;
+    ArenaString bio; // Stored in SocialNetwork's text arena
 
     // Constructor to initialize a User object
-    User(std::string username, std::string password, std::string bio)
+    User(const std::string& username, const std::string& password, const ArenaString& bio)
         : username(username), password(password), bio(bio) {}
 
     // Default constructor for when loading from file (needed for std::vector operations)
     User() = default;
 
-    // Method to display user profile information
-    void displayProfile() const {
+    // In a shard, a stand-in for a friend owned by another shard: it has no password, cannot log
+    // in and never posts; its friend list holds this shard's users who are friends with it
+    bool isRemote() const {
+        return password.empty();
+    }
+
+    // Method to display user profile information. The bio text is passed in from the arena.
+    void displayProfile(const std::string& bioText) const {
         std::cout << "--------------------------------\n";
         std::cout << "Profile: " << username << "\n";
-        std::cout << "Bio: " << desanitizeString(bio) << "\n";
+        std::cout << "Bio: " << desanitizeString(bioText) << "\n";
         std::cout << "--------------------------------\n";
     }
 };
@@ -63,450 +458,6201 @@ public:
 // --- Post Class ---
 class Post {
 public:
-    std::string postId;
-    std::string username;
-    std::string content;
-    std::string timestamp;
+    uint64_t postId; // See PostIdGenerator; SocialNetwork::posts is in ID order
+    UserId author; // Index of the author in SocialNetwork::users
+    ArenaString content; // Stored in SocialNetwork's text arena
+    Timestamp timestamp; // Microseconds since the epoch, see nextTimestamp()
 
     // Constructor to initialize a Post object
-    Post(std::string postId, std::string username, std::string content, std::string timestamp)
-        : postId(postId), username(username), content(content), timestamp(timestamp) {}
+    Post(uint64_t postId, UserId author, const ArenaString& content, Timestamp timestamp)
+        : postId(postId), author(author), content(content), timestamp(timestamp) {}
 
     // Default constructor for when loading from file (needed for std::vector operations)
     Post() = default;
 
-    // Method to display a post's content, author, and timestamp
-    void displayPost() const {
-        std::cout << "[" << timestamp << "] " << username << ": " << desanitizeString(content) << "\n";
+    // Method to display a post's content, author, and timestamp.
+    // The author's name and the content text are passed in because the post only stores references.
+    void displayPost(const std::string& authorName, const std::string& contentText) const {
+        std::cout << "[" << formatTimestamp(timestamp) << "] " << authorName << ": " << desanitizeString(contentText) << "\n";
     }
 };
 
-// Custom comparator for sorting Posts by timestamp in descending order
-struct ComparePostsByTimestamp {
-    bool operator()(const Post& a, const Post& b) const {
-        return a.timestamp > b.timestamp;
+// --- User Index ---
+
+// Open-addressing hash index from username to UserId (linear probing, load factor <= 1/2).
+// Each slot keeps the full hash next to the ID, so a probe only compares strings on a hash match.
+class UserIndex {
+private:
+    struct Slot {
+        uint32_t hash;
+        UserId id; // NO_USER marks an empty slot
+    };
+    std::vector<Slot> slots;
+    size_t count;
+
+    // Rebuilds the table with twice the capacity
+    void grow() {
+        std::vector<Slot> old;
+        old.swap(slots);
+        Slot empty = { 0, NO_USER };
+        slots.assign(old.empty() ? 16 : old.size() * 2, empty);
+        size_t mask = slots.size() - 1;
+        for (size_t i = 0; i < old.size(); ++i) {
+            if (old[i].id == NO_USER) {
+                continue;
+            }
+            size_t pos = old[i].hash & mask;
+            while (slots[pos].id != NO_USER) {
+                pos = (pos + 1) & mask;
+            }
+            slots[pos] = old[i];
+        }
+    }
+
+public:
+    UserIndex() : count(0) {}
+
+    // Returns the ID of 'username', or NO_USER. 'users' is the table the IDs index into.
+    UserId find(const std::string& username, const std::vector<User>& users) const {
+        return find(username.data(), username.size(), users);
+    }
+
+    // Same as above for a name that is not in a std::string (e.g. a field of a mapped file)
+    UserId find(const char* name, size_t length, const std::vector<User>& users) const {
+        if (slots.empty()) {
+            return NO_USER;
+        }
+        uint32_t hash = hashString(name, length);
+        size_t mask = slots.size() - 1;
+        for (size_t pos = hash & mask; slots[pos].id != NO_USER; pos = (pos + 1) & mask) {
+            const std::string& candidate = users[slots[pos].id].username;
+            if (slots[pos].hash == hash && candidate.size() == length && std::memcmp(candidate.data(), name, length) == 0) {
+                return slots[pos].id;
+            }
+        }
+        return NO_USER;
+    }
+
+    // Adds a username that is known not to be in the index yet
+    void insert(const std::string& username, UserId id) {
+        if ((count + 1) * 2 > slots.size()) {
+            grow();
+        }
+        uint32_t hash = hashString(username);
+        size_t mask = slots.size() - 1;
+        size_t pos = hash & mask;
+        while (slots[pos].id != NO_USER) {
+            pos = (pos + 1) & mask;
+        }
+        slots[pos].hash = hash;
+        slots[pos].id = id;
+        ++count;
+    }
+
+    void clear() {
+        slots.clear();
+        count = 0;
+    }
+
+    size_t memoryBytes() const {
+        return slots.capacity() * sizeof(Slot);
     }
 };
 
-// --- SocialNetwork Class ---
-class SocialNetwork {
-private:
-    // Added space between > and > for older compilers (digraph issue)
+// Point-in-time copy of the network state, written out as a snapshot by journal compaction
+struct NetworkSnapshot {
     std::vector<User> users;
-    std::map<std::string, std::vector<std::string> > friendships; // Added space here
+    std::vector<std::vector<UserId> > friendships;
     std::vector<Post> posts;
-    std::string loggedInUser; // Stores the username of the currently logged-in user
+    ArenaView text; // Bios and post contents
+};
 
-    // File names for data persistence
-    const std::string USERS_FILE = "users.txt";
-    const std::string FRIENDSHIPS_FILE = "friendships.txt";
-    const std::string POSTS_FILE = "posts.txt";
+// --- Binary Snapshot Format ---
+//
+// network.snap is the primary on-disk snapshot; the text files are only an import/export path.
+// Layout (native byte order, every section 8-byte aligned so records can be read in place):
+//   SnapshotHeader
+//   SnapshotUser[userCount]    indexed by UserId
+//   SnapshotEdge[edgeCount]    each friendship once
+//   post segments              see below
+//   string heap                raw bytes referenced by SnapshotString records
+// The header carries a checksum of its own fields and one of everything after it.
+//
+// Posts are stored in immutable columnar segments of up to POSTS_PER_SEGMENT posts each, in
+// posting order (the first post of segment n has handle n * POSTS_PER_SEGMENT):
+//   SnapshotSegmentTable
+//   SnapshotSegment[segmentCount]   directory: post count, ID and time range, column sizes
+//   segment bytes, per segment the columns one after another:
+//     authors      varint UserId per post (the users section is the author dictionary)
+//     timestamps   zigzag varint delta to the previous post's timestamp
+//     post IDs     varint delta to the previous post's ID (IDs increase)
+//     lengths      varint content length per post
+//     contents     the contents back to back
+// A reader can pick segments by their ID or time range and decode only the columns it needs.
 
-    // Helper to find a user by username in the 'users' vector
-    // Made const to be callable from const member functions
-    User* findUser(const std::string& username) const { // Added const here
-        for (size_t i = 0; i < users.size(); ++i) { // Changed to index-based loop
-            if (users[i].username == username) {
-                // Need to cast away constness if returning a non-const pointer
-                // This is generally discouraged, but necessary if the return type cannot be const User*
-                // For this simple app, we'll return a non-const pointer, assuming it's only used for read/write in non-const contexts
-                // or where the User object itself is not modified through this pointer in a const context.
-                // A better design might be to return const User* or a copy if no modification is intended.
-                return const_cast<User*>(&users[i]);
+const char SNAPSHOT_MAGIC[8] = { 'S', 'N', 'E', 'T', 'S', 'N', 'A', 'P' };
+const uint32_t SNAPSHOT_VERSION = 4; // The only version read; other files are set aside
+const uint32_t SNAPSHOT_BYTE_ORDER = 0x01020304u; // Reads back differently on a machine with another byte order
+
+struct SnapshotString {
+    uint64_t offset; // Into the string heap
+    uint32_t length;
+    uint32_t reserved;
+};
+
+struct SnapshotUser {
+    SnapshotString username;
+    SnapshotString password;
+    SnapshotString bio;
+};
+
+struct SnapshotEdge {
+    UserId user1;
+    UserId user2;
+};
+
+const size_t POSTS_PER_SEGMENT = 4096;
+
+struct SnapshotSegmentTable {
+    uint64_t segmentCount;
+    uint64_t reserved;
+};
+
+struct SnapshotSegment {
+    uint64_t offset;       // Of the segment's first column, from the start of the file
+    uint64_t size;         // Bytes of all columns together
+    uint64_t postCount;
+    uint64_t firstPostId;  // Posts are in ID order, so these bound every ID in the segment
+    uint64_t lastPostId;
+    Timestamp minTimestamp;
+    Timestamp maxTimestamp;
+    uint32_t authorBytes;  // Column sizes in column order; the contents take the rest of 'size'
+    uint32_t timestampBytes;
+    uint32_t postIdBytes;
+    uint32_t lengthBytes;
+};
+
+struct SnapshotHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t byteOrder;
+    uint64_t userCount;
+    uint64_t edgeCount;
+    uint64_t postCount;
+    uint64_t usersOffset;
+    uint64_t edgesOffset;
+    uint64_t postsOffset;
+    uint64_t stringsOffset;
+    uint64_t stringsSize;
+    uint64_t fileSize;
+    uint64_t bodyChecksum;   // Checksum of every byte after the header
+    uint64_t headerChecksum; // Checksum of the header bytes before this field
+};
+
+// Segment varints: 7 bits per byte, least significant first, high bit set on all but the last byte
+void appendVarint(std::string& out, uint64_t value) {
+    while (value >= 0x80) {
+        out += static_cast<char>(value | 0x80);
+        value >>= 7;
+    }
+    out += static_cast<char>(value);
+}
+
+// Reads one varint and advances 'pos'. Returns false if it runs past 'end' or is too long.
+bool readVarint(const char*& pos, const char* end, uint64_t& value) {
+    value = 0;
+    for (int shift = 0; shift < 64 && pos < end; shift += 7) {
+        uint8_t byte = static_cast<uint8_t>(*pos++);
+        value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Maps signed deltas to unsigned ones so small negative steps stay short: 0, -1, 1, -2, ...
+uint64_t zigzagEncode(int64_t value) {
+    return (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63);
+}
+
+int64_t zigzagDecode(uint64_t value) {
+    return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+}
+
+// The small columns of one segment, encoded before anything is written so the directory (which
+// precedes the segments) can carry every offset and size
+struct SegmentColumns {
+    std::string authors;
+    std::string timestamps;
+    std::string postIds;
+    std::string lengths;
+};
+
+// Encodes posts [begin, end) into 'columns' and fills in the directory entry, except its offset
+void encodeSegment(const std::vector<Post>& posts, size_t begin, size_t end, SnapshotSegment& entry, SegmentColumns& columns) {
+    std::memset(&entry, 0, sizeof(entry));
+    entry.postCount = end - begin;
+    entry.firstPostId = posts[begin].postId;
+    entry.lastPostId = posts[end - 1].postId;
+    entry.minTimestamp = posts[begin].timestamp;
+    entry.maxTimestamp = posts[begin].timestamp;
+    Timestamp previousTimestamp = 0;
+    uint64_t previousId = 0;
+    uint64_t contentBytes = 0;
+    for (size_t i = begin; i < end; ++i) {
+        const Post& post = posts[i];
+        appendVarint(columns.authors, post.author);
+        appendVarint(columns.timestamps, zigzagEncode(post.timestamp - previousTimestamp));
+        appendVarint(columns.postIds, post.postId - previousId);
+        appendVarint(columns.lengths, post.content.length);
+        previousTimestamp = post.timestamp;
+        previousId = post.postId;
+        contentBytes += post.content.length;
+        entry.minTimestamp = std::min(entry.minTimestamp, post.timestamp);
+        entry.maxTimestamp = std::max(entry.maxTimestamp, post.timestamp);
+    }
+    entry.authorBytes = static_cast<uint32_t>(columns.authors.size());
+    entry.timestampBytes = static_cast<uint32_t>(columns.timestamps.size());
+    entry.postIdBytes = static_cast<uint32_t>(columns.postIds.size());
+    entry.lengthBytes = static_cast<uint32_t>(columns.lengths.size());
+    entry.size = static_cast<uint64_t>(entry.authorBytes) + entry.timestampBytes + entry.postIdBytes + entry.lengthBytes + contentBytes;
+}
+
+// One segment decoded back into per-post arrays; contents stay in the mapped file
+struct DecodedSegment {
+    std::vector<UserId> authors;
+    std::vector<Timestamp> timestamps;
+    std::vector<uint64_t> postIds;
+    std::vector<uint32_t> lengths;
+    const char* contents;
+    bool ok;
+
+    DecodedSegment() : contents(NULL), ok(false) {}
+};
+
+// Decodes the segment at 'base + entry.offset'. Sets out.ok to false if a column is malformed.
+void decodeSegment(const char* base, const SnapshotSegment& entry, DecodedSegment& out) {
+    size_t count = static_cast<size_t>(entry.postCount);
+    const char* pos = base + entry.offset;
+    const char* authorsEnd = pos + entry.authorBytes;
+    const char* timestampsEnd = authorsEnd + entry.timestampBytes;
+    const char* postIdsEnd = timestampsEnd + entry.postIdBytes;
+    const char* lengthsEnd = postIdsEnd + entry.lengthBytes;
+    out.authors.resize(count);
+    out.timestamps.resize(count);
+    out.postIds.resize(count);
+    out.lengths.resize(count);
+    out.ok = false;
+    uint64_t value = 0;
+    uint64_t contentBytes = 0;
+    Timestamp timestamp = 0;
+    uint64_t postId = 0;
+    for (size_t i = 0; i < count; ++i) {
+        if (!readVarint(pos, authorsEnd, value) || value >= NO_USER) {
+            return;
+        }
+        out.authors[i] = static_cast<UserId>(value);
+    }
+    if (pos != authorsEnd) {
+        return;
+    }
+    for (size_t i = 0; i < count; ++i) {
+        if (!readVarint(pos, timestampsEnd, value)) {
+            return;
+        }
+        timestamp += zigzagDecode(value);
+        out.timestamps[i] = timestamp;
+    }
+    if (pos != timestampsEnd) {
+        return;
+    }
+    for (size_t i = 0; i < count; ++i) {
+        if (!readVarint(pos, postIdsEnd, value)) {
+            return;
+        }
+        postId += value;
+        out.postIds[i] = postId;
+    }
+    if (pos != postIdsEnd) {
+        return;
+    }
+    for (size_t i = 0; i < count; ++i) {
+        if (!readVarint(pos, lengthsEnd, value) || value > 0xFFFFFFFFu) {
+            return;
+        }
+        out.lengths[i] = static_cast<uint32_t>(value);
+        contentBytes += value;
+    }
+    uint64_t columnBytes = static_cast<uint64_t>(entry.authorBytes) + entry.timestampBytes + entry.postIdBytes + entry.lengthBytes;
+    out.contents = lengthsEnd;
+    out.ok = pos == lengthsEnd && contentBytes == entry.size - columnBytes;
+}
+
+// Streaming 64-bit checksum that mixes 8-byte words (FNV-style), fast enough to verify a large
+// snapshot at startup. The result does not depend on how the input is split across update() calls.
+class Checksum64 {
+private:
+    uint64_t hash;
+    uint64_t totalLength;
+    char pending[8];
+    size_t pendingLength;
+
+    void mix(const char* word) {
+        uint64_t value;
+        std::memcpy(&value, word, sizeof(value));
+        hash = (hash ^ value) * 1099511628211ULL;
+        hash ^= hash >> 32;
+    }
+
+public:
+    Checksum64() : hash(14695981039346656037ULL), totalLength(0), pendingLength(0) {}
+
+    void update(const void* data, size_t length) {
+        const char* bytes = static_cast<const char*>(data);
+        totalLength += length;
+        while (pendingLength != 0 && length != 0) {
+            pending[pendingLength++] = *bytes++;
+            --length;
+            if (pendingLength == sizeof(pending)) {
+                mix(pending);
+                pendingLength = 0;
             }
         }
-        return NULL; // Replaced nullptr with NULL
+        for (; length >= sizeof(pending); bytes += sizeof(pending), length -= sizeof(pending)) {
+            mix(bytes);
+        }
+        std::memcpy(pending + pendingLength, bytes, length);
+        pendingLength += length;
     }
 
-    // Helper to check if a user with the given username already exists
-    bool userExists(const std::string& username) const { // Added const here
-        return findUser(username) != NULL; // Replaced nullptr with NULL
+    uint64_t finish() const {
+        Checksum64 copy = *this;
+        if (copy.pendingLength != 0) {
+            std::memset(copy.pending + copy.pendingLength, 0, sizeof(copy.pending) - copy.pendingLength);
+            copy.mix(copy.pending);
+        }
+        char lengthWord[8];
+        std::memcpy(lengthWord, &totalLength, sizeof(lengthWord));
+        copy.mix(lengthWord);
+        return copy.hash;
+    }
+};
+
+// Read-only view of a whole file: mmap'ed where available, otherwise read into memory
+class MappedFile {
+private:
+    const char* bytes;
+    size_t length;
+#ifdef _WIN32
+    std::vector<char> buffer;
+#else
+    void* mapping;
+#endif
+
+public:
+#ifdef _WIN32
+    MappedFile() : bytes(NULL), length(0) {}
+#else
+    MappedFile() : bytes(NULL), length(0), mapping(NULL) {}
+#endif
+
+    ~MappedFile() {
+        close();
+    }
+
+    // Returns false if the file does not exist or cannot be read
+    bool open(const std::string& path) {
+        close();
+#ifdef _WIN32
+        std::ifstream in(path.c_str(), std::ios::binary);
+        if (!in.is_open()) {
+            return false;
+        }
+        in.seekg(0, std::ios::end);
+        buffer.resize(static_cast<size_t>(in.tellg()));
+        in.seekg(0, std::ios::beg);
+        if (!buffer.empty() && !in.read(&buffer[0], buffer.size())) {
+            buffer.clear();
+            return false;
+        }
+        bytes = buffer.empty() ? NULL : &buffer[0];
+        length = buffer.size();
+        return true;
+#else
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return false;
+        }
+        struct stat info;
+        if (fstat(fd, &info) != 0) {
+            ::close(fd);
+            return false;
+        }
+        length = static_cast<size_t>(info.st_size);
+        if (length != 0) {
+            mapping = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapping == MAP_FAILED) {
+                mapping = NULL;
+                length = 0;
+                ::close(fd);
+                return false;
+            }
+            bytes = static_cast<const char*>(mapping);
+        }
+        ::close(fd); // The mapping stays valid after the descriptor is closed
+        return true;
+#endif
+    }
+
+    void close() {
+#ifdef _WIN32
+        buffer.clear();
+#else
+        if (mapping != NULL) {
+            munmap(mapping, length);
+            mapping = NULL;
+        }
+#endif
+        bytes = NULL;
+        length = 0;
+    }
+
+    const char* data() const {
+        return bytes;
+    }
+
+    size_t size() const {
+        return length;
+    }
+
+    void swap(MappedFile& other) {
+        std::swap(bytes, other.bytes);
+        std::swap(length, other.length);
+#ifdef _WIN32
+        buffer.swap(other.buffer);
+#else
+        std::swap(mapping, other.mapping);
+#endif
+    }
+
+    // Declares that the mapping will be read sparsely and drops the pages touched so far from the
+    // process's resident set; they are read back (usually from the page cache) when accessed again.
+    // A no-op where the file is read into memory instead.
+    void evictResident() {
+#ifndef _WIN32
+        if (mapping != NULL) {
+            madvise(mapping, length, MADV_RANDOM);
+            madvise(mapping, length, MADV_DONTNEED);
+        }
+#endif
+    }
+};
+
+// --- Parallel Text Loader ---
+
+// Non-owning view of a field inside a mapped text file
+struct TextRef {
+    const char* data;
+    size_t length;
+
+    std::string str() const {
+        return std::string(data, length);
+    }
+};
+
+// A line-aligned slice of one mapped text file. Worker threads parse it into a flat list of
+// fieldsPerLine views per line, then (for friendships and posts) resolve the usernames to IDs.
+struct TextChunk {
+    const char* begin;
+    const char* end;
+    size_t fieldsPerLine; // The last field of a line takes the rest of the line, like std::getline
+    std::vector<TextRef> fields;
+    std::vector<UserId> ids; // Resolved usernames, one per line per name field
+};
+
+// Splits every line of a chunk into its '|'-separated fields without copying them
+struct ParseTextChunks {
+    std::vector<TextChunk>* chunks;
+
+    void operator()(size_t index) const {
+        TextChunk& chunk = (*chunks)[index];
+        const char* line = chunk.begin;
+        while (line < chunk.end) {
+            const char* lineEnd = static_cast<const char*>(std::memchr(line, '\n', chunk.end - line));
+            if (lineEnd == NULL) {
+                lineEnd = chunk.end;
+            }
+            if (lineEnd != line) { // Blank lines carry no record
+                const char* field = line;
+                for (size_t i = 0; i < chunk.fieldsPerLine; ++i) {
+                    const char* fieldEnd = lineEnd;
+                    if (i + 1 < chunk.fieldsPerLine) {
+                        const char* delimiter = static_cast<const char*>(std::memchr(field, '|', lineEnd - field));
+                        if (delimiter != NULL) {
+                            fieldEnd = delimiter;
+                        }
+                    }
+                    TextRef ref = { field, static_cast<size_t>(fieldEnd - field) };
+                    chunk.fields.push_back(ref);
+                    field = (fieldEnd < lineEnd) ? fieldEnd + 1 : lineEnd;
+                }
+            }
+            line = lineEnd + 1;
+        }
+    }
+};
+
+// Splits a mapped file into roughly equal chunks that each end on a line boundary
+void splitIntoChunks(const MappedFile& file, size_t fieldsPerLine, size_t targetChunks, std::vector<TextChunk>& chunks) {
+    const char* begin = file.data();
+    const char* fileEnd = begin + file.size();
+    size_t chunkSize = file.size() / targetChunks + 1;
+    while (begin < fileEnd) {
+        const char* end = (static_cast<size_t>(fileEnd - begin) > chunkSize) ? begin + chunkSize : fileEnd;
+        if (end < fileEnd) {
+            const char* newline = static_cast<const char*>(std::memchr(end, '\n', fileEnd - end));
+            end = (newline == NULL) ? fileEnd : newline + 1;
+        }
+        TextChunk chunk;
+        chunk.begin = begin;
+        chunk.end = end;
+        chunk.fieldsPerLine = fieldsPerLine;
+        chunks.push_back(chunk);
+        begin = end;
+    }
+}
+
+// Body of one worker thread of parallelFor: claims task indices until none are left
+template <typename Task>
+void runParallelTasks(const Task* task, std::atomic<size_t>* next, size_t count) {
+    for (size_t i = (*next)++; i < count; i = (*next)++) {
+        (*task)(i);
+    }
+}
+
+// Runs task(i) for every i in [0, count) on up to one thread per hardware core
+template <typename Task>
+void parallelFor(size_t count, const Task& task) {
+    size_t workers = std::max(1u, std::thread::hardware_concurrency());
+    workers = std::min(workers, count);
+    std::atomic<size_t> next(0);
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < workers; ++i) {
+        threads.push_back(std::thread(runParallelTasks<Task>, &task, &next, count));
+    }
+    runParallelTasks(&task, &next, count); // The calling thread works too
+    for (size_t i = 0; i < threads.size(); ++i) {
+        threads[i].join();
+    }
+}
+
+// One author's posts during a feed merge: the not yet merged part of their postsByAuthor list
+struct FeedStream {
+    const PostHandle* begin; // Oldest post of the author
+    const PostHandle* end;   // One past the newest post not merged yet
+};
+
+// Custom comparator for the feed merge heap: the stream with the newest remaining post comes first
+struct CompareFeedStreams {
+    bool operator()(const FeedStream& a, const FeedStream& b) const {
+        return *(a.end - 1) < *(b.end - 1);
+    }
+};
+
+// --- Sorted Set Intersection ---
+
+// Lists whose sizes differ by more than this factor are intersected by galloping
+const size_t GALLOP_RATIO = 32;
+
+// First position in [begin, end) whose value is >= target, found by doubling steps from 'begin'
+// and a binary search within the last step: O(log distance) instead of O(distance)
+const UserId* gallop(const UserId* begin, const UserId* end, UserId target) {
+    size_t step = 1;
+    const UserId* low = begin;
+    while (step < static_cast<size_t>(end - low) && low[step] < target) { // Distances: low + step may be past end
+        low += step;
+        step *= 2;
+    }
+    return std::lower_bound(low, low + std::min(step + 1, static_cast<size_t>(end - low)), target);
+}
+
+// Intersects two sorted, duplicate-free lists. A linear merge when the sizes are similar;
+// otherwise every element of the short list gallops through the long one, O(s log(l / s)).
+// Appends the common values to 'out' unless it is NULL; returns how many there are.
+size_t intersectSorted(const std::vector<UserId>& a, const std::vector<UserId>& b, std::vector<UserId>* out) {
+    const std::vector<UserId>& small = a.size() <= b.size() ? a : b;
+    const std::vector<UserId>& large = a.size() <= b.size() ? b : a;
+    if (small.empty()) {
+        return 0;
+    }
+    size_t count = 0;
+    const UserId* s = &small[0];
+    const UserId* sEnd = s + small.size();
+    const UserId* l = &large[0];
+    const UserId* lEnd = l + large.size();
+    bool galloping = large.size() / small.size() > GALLOP_RATIO;
+    while (s < sEnd && l < lEnd) {
+        if (galloping) {
+            l = gallop(l, lEnd, *s);
+            if (l == lEnd) {
+                break;
+            }
+        }
+        if (*s < *l) {
+            ++s;
+        } else if (*l < *s) {
+            ++l;
+        } else {
+            if (out != NULL) {
+                out->push_back(*s);
+            }
+            ++count;
+            ++s;
+            ++l;
+        }
+    }
+    return count;
+}
+
+// A friend suggestion and how many friends it shares with the user
+struct FriendSuggestion {
+    UserId user;
+    uint32_t mutualFriends;
+};
+
+// Most mutual friends first, then the lower ID for a stable order
+struct CompareSuggestions {
+    bool operator()(const FriendSuggestion& a, const FriendSuggestion& b) const {
+        return a.mutualFriends != b.mutualFriends ? a.mutualFriends > b.mutualFriends : a.user < b.user;
+    }
+};
+
+// --- Search Index ---
+
+// Splits text into lowercase search terms: runs of ASCII letters and digits plus any non-ASCII
+// (UTF-8) bytes, so accented words stay whole. Terms are cut at MAX_TERM_LENGTH bytes.
+const size_t MAX_TERM_LENGTH = 32;
+
+// Lowercased character for term bytes, 0 for separators
+struct TermCharTable {
+    char map[256];
+
+    TermCharTable() {
+        for (int c = 0; c < 256; ++c) {
+            map[c] = ((c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') || c >= 0x80) ? static_cast<char>(c)
+                   : (c >= 'A' && c <= 'Z') ? static_cast<char>(c - 'A' + 'a') : 0;
+        }
+    }
+};
+
+const TermCharTable termChars;
+
+void tokenize(const char* data, size_t length, std::vector<std::string>& terms) {
+    size_t count = 0;
+    size_t i = 0;
+    while (i < length) {
+        while (i < length && termChars.map[static_cast<unsigned char>(data[i])] == 0) {
+            ++i;
+        }
+        if (i == length) {
+            break;
+        }
+        if (count == terms.size()) {
+            terms.push_back(std::string()); // Reuse the strings of earlier calls where possible
+        }
+        std::string& term = terms[count++];
+        term.clear();
+        for (; i < length && termChars.map[static_cast<unsigned char>(data[i])] != 0; ++i) {
+            if (term.size() < MAX_TERM_LENGTH) {
+                term += termChars.map[static_cast<unsigned char>(data[i])];
+            }
+        }
+    }
+    terms.resize(count);
+}
+
+// The posts containing one term, in ascending PostHandle order, delta-encoded as varints.
+// Every POSTING_BLOCK postings start a new block whose first handle is kept uncompressed in a
+// skip table, so a cursor can jump to any handle and walk the list backwards block by block.
+class PostingList {
+public:
+    static const size_t POSTING_BLOCK = 128;
+
+    struct Block {
+        PostHandle first;  // First handle of the block (not repeated in 'bytes')
+        uint32_t offset;   // Where the block's deltas start in 'bytes'
+    };
+
+private:
+    std::vector<uint8_t> bytes;
+    std::vector<Block> blocks;
+    PostHandle last;
+    uint32_t count;
+
+public:
+    PostingList() : last(NO_POST), count(0) {}
+
+    // Appends a handle; handles must arrive in ascending order (a post is indexed once)
+    void add(PostHandle handle) {
+        if (count > 0 && handle <= last) {
+            return; // Term repeated within the same post
+        }
+        if (count % POSTING_BLOCK == 0) {
+            Block block = { handle, static_cast<uint32_t>(bytes.size()) };
+            blocks.push_back(block);
+        } else {
+            uint32_t delta = handle - last;
+            while (delta >= 0x80) {
+                bytes.push_back(static_cast<uint8_t>(delta | 0x80));
+                delta >>= 7;
+            }
+            bytes.push_back(static_cast<uint8_t>(delta));
+        }
+        last = handle;
+        ++count;
+    }
+
+    size_t size() const { return count; }
+    size_t blockCount() const { return blocks.size(); }
+    const Block& block(size_t index) const { return blocks[index]; }
+
+    // Decodes block 'index' into 'out' in ascending order
+    void decodeBlock(size_t index, std::vector<PostHandle>& out) const {
+        out.clear();
+        size_t postings = std::min(POSTING_BLOCK, count - index * POSTING_BLOCK);
+        PostHandle handle = blocks[index].first;
+        out.push_back(handle);
+        size_t pos = blocks[index].offset;
+        for (size_t i = 1; i < postings; ++i) {
+            uint32_t delta = 0;
+            int shift = 0;
+            uint8_t byte;
+            do {
+                byte = bytes[pos++];
+                delta |= static_cast<uint32_t>(byte & 0x7F) << shift;
+                shift += 7;
+            } while (byte & 0x80);
+            handle += delta;
+            out.push_back(handle);
+        }
+    }
+
+    size_t memoryBytes() const {
+        return bytes.capacity() + blocks.capacity() * sizeof(Block);
+    }
+};
+
+const size_t PostingList::POSTING_BLOCK; // Defined here too: std::min takes it by reference
+
+// Walks a posting list from the newest handle to the oldest
+class PostingCursor {
+private:
+    const PostingList* list;
+    size_t blockIndex;
+    std::vector<PostHandle> decoded; // The current block, ascending
+    size_t pos;                      // current() is decoded[pos]
+    bool valid;
+
+    void load(size_t index) {
+        blockIndex = index;
+        list->decodeBlock(index, decoded);
+    }
+
+public:
+    explicit PostingCursor(const PostingList* list) : list(list), blockIndex(0), pos(0), valid(list->size() > 0) {
+        if (valid) {
+            load(list->blockCount() - 1);
+            pos = decoded.size() - 1;
+        }
+    }
+
+    bool atEnd() const { return !valid; }
+    PostHandle current() const { return decoded[pos]; }
+
+    // Moves to the next older handle
+    void next() {
+        if (pos > 0) {
+            --pos;
+        } else if (blockIndex > 0) {
+            load(blockIndex - 1);
+            pos = decoded.size() - 1;
+        } else {
+            valid = false;
+        }
+    }
+
+    // Moves to the newest handle <= target (never forward); ends the cursor if there is none
+    void seekAtMost(PostHandle target) {
+        if (!valid || current() <= target) {
+            return;
+        }
+        if (decoded[0] > target) {
+            // Binary search the skip table for the last block starting at or before 'target'
+            size_t low = 0;
+            size_t high = blockIndex; // Blocks [high, ...) start after target
+            while (low < high) {
+                size_t mid = (low + high) / 2;
+                if (list->block(mid).first <= target) {
+                    low = mid + 1;
+                } else {
+                    high = mid;
+                }
+            }
+            if (low == 0) {
+                valid = false;
+                return;
+            }
+            load(low - 1);
+        }
+        pos = std::upper_bound(decoded.begin(), decoded.end(), target) - decoded.begin() - 1;
+    }
+};
+
+// Orders posting lists from the shortest to the longest
+struct CompareListSizes {
+    bool operator()(const PostingList* a, const PostingList* b) const {
+        return a->size() < b->size();
+    }
+};
+
+// Inverted index from search term to the posts containing it. Posts are added in handle order,
+// so every posting list stays sorted without any merging. The term dictionary is open addressing
+// like UserIndex, with the term text in an arena, so a new term costs no allocation of its own.
+class SearchIndex {
+private:
+    static const uint32_t NO_TERM = 0xFFFFFFFF;
+
+    struct Slot {
+        uint32_t hash;
+        uint32_t term; // Index into 'lists'; NO_TERM marks an empty slot
+    };
+    std::vector<Slot> slots;
+    StringArena termText;
+    std::vector<ArenaString> termNames;
+    std::vector<PostingList> lists;
+    std::vector<std::string> scratch; // Terms of the post being added
+
+    // Slot holding the term, or the empty slot where it would go
+    size_t findSlot(const char* term, size_t length, uint32_t hash) const {
+        size_t mask = slots.size() - 1;
+        size_t pos = hash & mask;
+        while (slots[pos].term != NO_TERM) {
+            const ArenaString& name = termNames[slots[pos].term];
+            if (slots[pos].hash == hash && name.length == length && std::memcmp(termText.data(name), term, length) == 0) {
+                break;
+            }
+            pos = (pos + 1) & mask;
+        }
+        return pos;
+    }
+
+    // Rebuilds the table with twice the capacity
+    void grow() {
+        std::vector<Slot> old;
+        old.swap(slots);
+        Slot empty = { 0, NO_TERM };
+        slots.assign(old.empty() ? 1024 : old.size() * 2, empty);
+        size_t mask = slots.size() - 1;
+        for (size_t i = 0; i < old.size(); ++i) {
+            if (old[i].term == NO_TERM) {
+                continue;
+            }
+            size_t pos = old[i].hash & mask;
+            while (slots[pos].term != NO_TERM) {
+                pos = (pos + 1) & mask;
+            }
+            slots[pos] = old[i];
+        }
+    }
+
+public:
+    void add(PostHandle handle, const char* text, size_t length) {
+        tokenize(text, length, scratch);
+        for (size_t i = 0; i < scratch.size(); ++i) {
+            if ((lists.size() + 1) * 2 > slots.size()) {
+                grow();
+            }
+            const std::string& term = scratch[i];
+            uint32_t hash = hashString(term.data(), term.size());
+            size_t pos = findSlot(term.data(), term.size(), hash);
+            if (slots[pos].term == NO_TERM) {
+                slots[pos].hash = hash;
+                slots[pos].term = static_cast<uint32_t>(lists.size());
+                termNames.push_back(termText.append(term));
+                lists.push_back(PostingList());
+            }
+            lists[slots[pos].term].add(handle);
+        }
+    }
+
+    // Posting list of 'term', or NULL if no post contains it
+    const PostingList* find(const std::string& term) const {
+        if (slots.empty()) {
+            return NULL;
+        }
+        size_t pos = findSlot(term.data(), term.size(), hashString(term.data(), term.size()));
+        return slots[pos].term == NO_TERM ? NULL : &lists[slots[pos].term];
+    }
+
+    void clear() {
+        slots.clear();
+        termText.clear();
+        termNames.clear();
+        lists.clear();
+    }
+
+    uint64_t memoryBytes() const {
+        uint64_t bytes = slots.capacity() * sizeof(Slot) + termText.memoryBytes() + termNames.capacity() * sizeof(ArenaString)
+                       + lists.capacity() * sizeof(PostingList);
+        for (size_t i = 0; i < lists.size(); ++i) {
+            bytes += lists[i].memoryBytes();
+        }
+        return bytes;
+    }
+};
+
+// A parsed search: every term must occur, and each phrase must occur as consecutive terms
+struct SearchQuery {
+    std::vector<std::string> terms;
+    std::vector<std::vector<std::string> > phrases;
+
+    // Words are ANDed; text in double quotes is a phrase, e.g.  coffee "new york"
+    explicit SearchQuery(const std::string& query) {
+        std::vector<std::string> words;
+        bool quoted = false;
+        size_t start = 0;
+        for (size_t i = 0; i <= query.size(); ++i) {
+            if (i == query.size() || query[i] == '"') {
+                tokenize(query.data() + start, i - start, words);
+                if (quoted && words.size() > 1) {
+                    phrases.push_back(words);
+                }
+                terms.insert(terms.end(), words.begin(), words.end());
+                quoted = !quoted;
+                start = i + 1;
+            }
+        }
+        std::sort(terms.begin(), terms.end());
+        terms.erase(std::unique(terms.begin(), terms.end()), terms.end());
+    }
+
+    // Whether the post text contains every phrase (the terms were already matched by the index)
+    bool matchesPhrases(const char* text, size_t length) const {
+        if (phrases.empty()) {
+            return true;
+        }
+        std::vector<std::string> words;
+        tokenize(text, length, words);
+        for (size_t p = 0; p < phrases.size(); ++p) {
+            if (std::search(words.begin(), words.end(), phrases[p].begin(), phrases[p].end()) == words.end()) {
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+// --- Trending ---
+
+const size_t TRENDING_SKETCH_DEPTH = 4;     // Rows of each count-min sketch
+const size_t TRENDING_SKETCH_WIDTH = 1024;  // Counters per row; a power of two
+const size_t TRENDING_CANDIDATES = 64;      // Heavy-hitter candidates kept per window and kind
+const size_t TRENDING_COUNT = 10;           // Posters and terms shown
+const size_t MIN_TRENDING_TERM_LENGTH = 3;  // Shorter terms are not counted
+
+// The trending windows and how finely each one slides
+struct TrendingWindowSpec {
+    const char* name;
+    Timestamp bucketMicros;
+    size_t buckets;
+};
+
+const TrendingWindowSpec TRENDING_WINDOWS[] = {
+    { "5m", 10 * 1000000LL, 30 },       // 5 minutes in 10-second buckets
+    { "1h", 60 * 1000000LL, 60 },       // 1 hour in 1-minute buckets
+    { "1d", 15 * 60 * 1000000LL, 96 }   // 1 day in 15-minute buckets
+};
+const size_t TRENDING_WINDOW_COUNT = sizeof(TRENDING_WINDOWS) / sizeof(TRENDING_WINDOWS[0]);
+
+// Common words that would otherwise always trend; sorted
+const char* const TRENDING_STOP_WORDS[] = {
+    "and", "are", "but", "can", "for", "from", "had", "has", "have", "her", "his", "its", "just", "not",
+    "now", "our", "out", "she", "that", "the", "their", "them", "then", "there", "they", "this", "was",
+    "were", "what", "when", "will", "with", "you", "your"
+};
+
+struct CompareCStrings {
+    bool operator()(const char* a, const char* b) const {
+        return std::strcmp(a, b) < 0;
+    }
+};
+
+bool isTrendingTerm(const std::string& term) {
+    const char* const* end = TRENDING_STOP_WORDS + sizeof(TRENDING_STOP_WORDS) / sizeof(TRENDING_STOP_WORDS[0]);
+    return term.size() >= MIN_TRENDING_TERM_LENGTH
+        && !std::binary_search(TRENDING_STOP_WORDS, end, term.c_str(), CompareCStrings());
+}
+
+// Spreads the bits of a key (a UserId, a string hash) over 64 bits (splitmix64's finalizer)
+uint64_t mixBits(uint64_t value) {
+    value = (value ^ (value >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    value = (value ^ (value >> 27)) * 0x94D049BB133111EBULL;
+    return value ^ (value >> 31);
+}
+
+// Count-min sketch over a sliding time window: a ring with one sketch per time bucket, plus their
+// running sum, from which a bucket is subtracted when it leaves the window. Estimates are never
+// below the true count and exceed it by at most ~e/WIDTH of the window's total with high probability.
+class WindowedCountMin {
+private:
+    Timestamp bucketMicros;
+    size_t bucketCount;
+    std::vector<uint32_t> buckets;    // bucketCount sketches of DEPTH * WIDTH counters
+    std::vector<uint32_t> total;      // Their sum
+    std::vector<uint32_t> additions;  // Per bucket, how many times add() counted something
+    uint64_t totalAdditions;
+    int64_t newest; // Number (time / bucketMicros) of the window's newest bucket; -1 until the first advance()
+
+    static size_t cell(size_t row, uint64_t hash) {
+        uint32_t h1 = static_cast<uint32_t>(hash);
+        uint32_t h2 = static_cast<uint32_t>(hash >> 32) | 1; // Row i uses h1 + i * h2 (double hashing)
+        return row * TRENDING_SKETCH_WIDTH + ((h1 + row * h2) & (TRENDING_SKETCH_WIDTH - 1));
+    }
+
+public:
+    WindowedCountMin(Timestamp bucketMicros, size_t bucketCount)
+        : bucketMicros(bucketMicros), bucketCount(bucketCount),
+          buckets(bucketCount * TRENDING_SKETCH_DEPTH * TRENDING_SKETCH_WIDTH, 0),
+          total(TRENDING_SKETCH_DEPTH * TRENDING_SKETCH_WIDTH, 0), additions(bucketCount, 0), totalAdditions(0), newest(-1) {}
+
+    // Slides the window forward so it ends with the bucket of 'time'. Returns true if buckets expired.
+    bool advance(Timestamp time) {
+        int64_t bucket = time / bucketMicros;
+        if (newest < 0) {
+            newest = bucket;
+            return false;
+        }
+        if (bucket <= newest) {
+            return false;
+        }
+        int64_t steps = std::min<int64_t>(bucket - newest, static_cast<int64_t>(bucketCount));
+        for (int64_t step = 1; step <= steps; ++step) {
+            size_t slot = static_cast<size_t>((newest + step) % static_cast<int64_t>(bucketCount));
+            uint32_t* counts = &buckets[slot * TRENDING_SKETCH_DEPTH * TRENDING_SKETCH_WIDTH];
+            for (size_t i = 0; i < total.size(); ++i) {
+                total[i] -= counts[i];
+                counts[i] = 0;
+            }
+            totalAdditions -= additions[slot];
+            additions[slot] = 0;
+        }
+        newest = bucket;
+        return true;
+    }
+
+    // Counts one occurrence of 'hash' at 'time', which must not be after the window (see advance()).
+    // Returns false if it is before the window.
+    bool add(uint64_t hash, Timestamp time) {
+        int64_t bucket = time / bucketMicros;
+        if (newest < 0 || bucket <= newest - static_cast<int64_t>(bucketCount) || bucket > newest) {
+            return false;
+        }
+        size_t slot = static_cast<size_t>(bucket % static_cast<int64_t>(bucketCount));
+        uint32_t* counts = &buckets[slot * TRENDING_SKETCH_DEPTH * TRENDING_SKETCH_WIDTH];
+        for (size_t row = 0; row < TRENDING_SKETCH_DEPTH; ++row) {
+            size_t index = cell(row, hash);
+            ++counts[index];
+            ++total[index];
+        }
+        ++additions[slot];
+        ++totalAdditions;
+        return true;
+    }
+
+    uint32_t estimate(uint64_t hash) const {
+        uint32_t count = std::numeric_limits<uint32_t>::max();
+        for (size_t row = 0; row < TRENDING_SKETCH_DEPTH; ++row) {
+            count = std::min(count, total[cell(row, hash)]);
+        }
+        return count;
+    }
+
+    // Occurrences counted in the window
+    uint64_t size() const {
+        return totalAdditions;
+    }
+
+    void clear() {
+        std::fill(buckets.begin(), buckets.end(), 0);
+        std::fill(total.begin(), total.end(), 0);
+        std::fill(additions.begin(), additions.end(), 0);
+        totalAdditions = 0;
+        newest = -1;
+    }
+
+    uint64_t memoryBytes() const {
+        return (buckets.capacity() + total.capacity() + additions.capacity()) * sizeof(uint32_t);
+    }
+};
+
+// The most frequent keys of a sliding window. The sketch estimates every key's count; a min-heap on
+// the estimates keeps the TRENDING_CANDIDATES best keys seen so far, and a key replaces the heap's
+// smallest one as soon as its estimate is higher. Estimates only drop when a bucket expires, so all
+// candidates are re-estimated then.
+template <typename Key>
+class HeavyHitters {
+private:
+    struct Candidate {
+        Key key;
+        uint64_t hash;
+        uint32_t count;
+    };
+
+    // Heap order: the smallest count on top
+    struct CompareCandidates {
+        bool operator()(const Candidate& a, const Candidate& b) const {
+            return a.count > b.count;
+        }
+    };
+
+    struct CompareByCount {
+        bool operator()(const std::pair<Key, uint32_t>& a, const std::pair<Key, uint32_t>& b) const {
+            return a.second > b.second;
+        }
+    };
+
+    WindowedCountMin sketch;
+    std::vector<Candidate> heap;
+
+    // Restores the heap below 'pos' after the count there grew
+    void siftDown(size_t pos) {
+        CompareCandidates compare;
+        while (true) {
+            size_t smallest = pos;
+            size_t left = 2 * pos + 1;
+            if (left < heap.size() && compare(heap[smallest], heap[left])) {
+                smallest = left;
+            }
+            if (left + 1 < heap.size() && compare(heap[smallest], heap[left + 1])) {
+                smallest = left + 1;
+            }
+            if (smallest == pos) {
+                return;
+            }
+            std::swap(heap[pos], heap[smallest]);
+            pos = smallest;
+        }
+    }
+
+public:
+    HeavyHitters(Timestamp bucketMicros, size_t bucketCount) : sketch(bucketMicros, bucketCount) {}
+
+    void advance(Timestamp time) {
+        if (sketch.advance(time)) {
+            for (size_t i = 0; i < heap.size(); ++i) {
+                heap[i].count = sketch.estimate(heap[i].hash);
+            }
+            std::make_heap(heap.begin(), heap.end(), CompareCandidates());
+        }
+    }
+
+    void add(const Key& key, uint64_t hash, Timestamp time) {
+        if (!sketch.add(hash, time)) {
+            return;
+        }
+        uint32_t count = sketch.estimate(hash);
+        for (size_t i = 0; i < heap.size(); ++i) { // A linear scan: the heap is small and usually in cache
+            if (heap[i].hash == hash && heap[i].key == key) { // Colliding keys stay separate candidates
+                heap[i].count = count;
+                siftDown(i);
+                return;
+            }
+        }
+        Candidate candidate = { key, hash, count };
+        if (heap.size() < TRENDING_CANDIDATES) {
+            heap.push_back(candidate);
+            std::push_heap(heap.begin(), heap.end(), CompareCandidates());
+        } else if (count > heap[0].count) {
+            heap[0] = candidate;
+            siftDown(0);
+        }
+    }
+
+    // The 'limit' keys with the highest estimates, highest first
+    std::vector<std::pair<Key, uint32_t> > top(size_t limit) const {
+        std::vector<std::pair<Key, uint32_t> > keys;
+        for (size_t i = 0; i < heap.size(); ++i) {
+            if (heap[i].count > 0) {
+                keys.push_back(std::make_pair(heap[i].key, heap[i].count));
+            }
+        }
+        std::sort(keys.begin(), keys.end(), CompareByCount());
+        keys.resize(std::min(keys.size(), limit));
+        return keys;
+    }
+
+    uint64_t size() const {
+        return sketch.size();
+    }
+
+    void clear() {
+        sketch.clear();
+        heap.clear();
+    }
+
+    uint64_t memoryBytes() const {
+        return sketch.memoryBytes() + heap.capacity() * sizeof(Candidate);
+    }
+};
+
+// What a trending window holds right now; counts are estimates
+struct TrendingReport {
+    uint64_t posts; // Posts in the window
+    std::vector<std::pair<UserId, uint32_t> > posters;   // Most active first, with their posts
+    std::vector<std::pair<std::string, uint32_t> > terms; // Most frequent first, with the posts using them
+};
+
+// Streaming activity counters for the TRENDING_WINDOWS: every post is counted once for its author
+// and once for each distinct term in it, so a trending query never looks at the post table.
+// Memory is fixed by the constants above, whatever the number of users, terms or posts.
+class Trending {
+private:
+    struct Window {
+        HeavyHitters<UserId> posters;
+        HeavyHitters<std::string> terms;
+
+        explicit Window(const TrendingWindowSpec& spec)
+            : posters(spec.bucketMicros, spec.buckets), terms(spec.bucketMicros, spec.buckets) {}
+    };
+
+    std::vector<Window> windows; // Parallel to TRENDING_WINDOWS
+    Timestamp horizon;           // Longest window span; older posts are not counted
+    std::vector<std::string> scratch;
+    std::mutex mutex; // Queries slide the windows too
+
+public:
+    Trending() : horizon(0) {
+        for (size_t i = 0; i < TRENDING_WINDOW_COUNT; ++i) {
+            windows.push_back(Window(TRENDING_WINDOWS[i]));
+            horizon = std::max(horizon, TRENDING_WINDOWS[i].bucketMicros * static_cast<Timestamp>(TRENDING_WINDOWS[i].buckets));
+        }
+    }
+
+    // Counts a post. Posts from before the longest window (most of a loaded history) are skipped
+    // before any work, and each window skips posts older than itself; timestamps from the future
+    // count as now.
+    void add(Timestamp timestamp, UserId author, const char* text, size_t length) {
+        Timestamp current = currentTime();
+        if (timestamp < current - horizon) {
+            return;
+        }
+        timestamp = std::min(timestamp, current);
+        std::lock_guard<std::mutex> lock(mutex);
+        tokenize(text, length, scratch);
+        std::sort(scratch.begin(), scratch.end());
+        scratch.erase(std::unique(scratch.begin(), scratch.end()), scratch.end());
+        for (size_t i = 0; i < windows.size(); ++i) {
+            if (timestamp < current - TRENDING_WINDOWS[i].bucketMicros * static_cast<Timestamp>(TRENDING_WINDOWS[i].buckets)) {
+                continue;
+            }
+            Window& window = windows[i];
+            window.posters.advance(timestamp);
+            window.terms.advance(timestamp);
+            window.posters.add(author, mixBits(author), timestamp);
+            for (size_t t = 0; t < scratch.size(); ++t) {
+                if (isTrendingTerm(scratch[t])) {
+                    window.terms.add(scratch[t], mixBits(hashString64(scratch[t])), timestamp);
+                }
+            }
+        }
+    }
+
+    // Fills 'report' for the window named 'name' as of now. Returns false for an unknown window.
+    bool report(const std::string& name, size_t limit, TrendingReport& report) {
+        for (size_t i = 0; i < TRENDING_WINDOW_COUNT; ++i) {
+            if (name != TRENDING_WINDOWS[i].name) {
+                continue;
+            }
+            std::lock_guard<std::mutex> lock(mutex);
+            Window& window = windows[i];
+            Timestamp current = currentTime();
+            window.posters.advance(current);
+            window.terms.advance(current);
+            report.posts = window.posters.size();
+            report.posters = window.posters.top(limit);
+            report.terms = window.terms.top(limit);
+            return true;
+        }
+        return false;
+    }
+
+    void clear() {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (size_t i = 0; i < windows.size(); ++i) {
+            windows[i].posters.clear();
+            windows[i].terms.clear();
+        }
+    }
+
+    uint64_t memoryBytes() {
+        std::lock_guard<std::mutex> lock(mutex);
+        uint64_t bytes = windows.capacity() * sizeof(Window);
+        for (size_t i = 0; i < windows.size(); ++i) {
+            bytes += windows[i].posters.memoryBytes() + windows[i].terms.memoryBytes();
+        }
+        return bytes;
+    }
+};
+
+// --- Graph Analytics ---
+
+// Follows parent links to the root, halving the path on the way (other threads may do the same)
+UserId findComponentRoot(std::atomic<UserId>* parent, UserId user) {
+    while (true) {
+        UserId up = parent[user].load(std::memory_order_relaxed);
+        if (up == user) {
+            return user;
+        }
+        UserId upUp = parent[up].load(std::memory_order_relaxed);
+        if (up != upUp) {
+            parent[user].compare_exchange_weak(up, upUp, std::memory_order_relaxed);
+        }
+        user = upUp;
+    }
+}
+
+// Lock-free union: the root with the larger ID is linked below the smaller one with a CAS, retrying
+// if another thread moved either root first. Links only ever point to smaller IDs, so there are no
+// cycles, and each component ends up represented by its smallest user ID.
+void uniteComponents(std::atomic<UserId>* parent, UserId a, UserId b) {
+    while (true) {
+        a = findComponentRoot(parent, a);
+        b = findComponentRoot(parent, b);
+        if (a == b) {
+            return;
+        }
+        if (a < b) {
+            std::swap(a, b);
+        }
+        UserId expected = a;
+        if (parent[a].compare_exchange_strong(expected, b)) {
+            return;
+        }
+    }
+}
+
+// Immutable compressed-sparse-row copy of the friendship graph: the friends of user u are
+// targets[offsets[u] .. offsets[u + 1]), sorted. Analytics run on this point-in-time copy and
+// hold no lock of the live network while they work.
+class FriendGraph {
+private:
+    std::vector<uint64_t> offsets;
+    std::vector<UserId> targets;
+
+    // Connected components, computed once on first use
+    mutable std::once_flag componentsOnce;
+    mutable std::vector<UserId> componentOf;      // Smallest user ID of each user's component
+    mutable std::vector<uint32_t> componentSizes; // Indexed by that representative
+    mutable size_t componentCount;
+    mutable size_t largestComponent;
+
+    static const size_t CHUNK = 4096; // Users per parallel task
+
+    // parallelFor step: unites every edge of a range of users (each edge once, from its lower end)
+    struct UniteEdges {
+        const FriendGraph* graph;
+        std::atomic<UserId>* parent;
+
+        void operator()(size_t chunk) const {
+            UserId end = static_cast<UserId>(std::min(graph->userCount(), (chunk + 1) * CHUNK));
+            for (UserId user = static_cast<UserId>(chunk * CHUNK); user < end; ++user) {
+                const UserId* last = graph->friendsEnd(user);
+                for (const UserId* it = std::upper_bound(graph->friendsBegin(user), last, user); it != last; ++it) {
+                    uniteComponents(parent, user, *it);
+                }
+            }
+        }
+    };
+
+    // parallelFor step: resolves the final root of a range of users
+    struct ResolveRoots {
+        const FriendGraph* graph;
+        std::atomic<UserId>* parent;
+
+        void operator()(size_t chunk) const {
+            UserId end = static_cast<UserId>(std::min(graph->userCount(), (chunk + 1) * CHUNK));
+            for (UserId user = static_cast<UserId>(chunk * CHUNK); user < end; ++user) {
+                graph->componentOf[user] = findComponentRoot(parent, user);
+            }
+        }
+    };
+
+    void computeComponents() const {
+        size_t count = userCount();
+        std::vector<std::atomic<UserId> > parent(count);
+        for (UserId user = 0; user < count; ++user) {
+            parent[user].store(user, std::memory_order_relaxed);
+        }
+        size_t chunks = (count + CHUNK - 1) / CHUNK;
+        std::atomic<UserId>* parents = count == 0 ? NULL : &parent[0];
+        UniteEdges unite = { this, parents };
+        parallelFor(chunks, unite);
+        componentOf.assign(count, NO_USER);
+        ResolveRoots resolve = { this, parents };
+        parallelFor(chunks, resolve);
+
+        componentSizes.assign(count, 0);
+        componentCount = 0;
+        largestComponent = 0;
+        for (UserId user = 0; user < count; ++user) {
+            uint32_t size = ++componentSizes[componentOf[user]];
+            componentCount += (componentOf[user] == user) ? 1 : 0;
+            largestComponent = std::max<size_t>(largestComponent, size);
+        }
+    }
+
+    void ensureComponents() const {
+        std::call_once(componentsOnce, &FriendGraph::computeComponents, this);
+    }
+
+public:
+    // Takes over the arrays (they are swapped out of the arguments)
+    FriendGraph(std::vector<uint64_t>& offsets, std::vector<UserId>& targets) : componentCount(0), largestComponent(0) {
+        this->offsets.swap(offsets);
+        this->targets.swap(targets);
+    }
+
+    size_t userCount() const { return offsets.empty() ? 0 : offsets.size() - 1; }
+    size_t friendshipCount() const { return targets.size() / 2; }
+    const UserId* friendsBegin(UserId user) const { return targets.empty() ? NULL : &targets[0] + offsets[user]; }
+    const UserId* friendsEnd(UserId user) const { return targets.empty() ? NULL : &targets[0] + offsets[user + 1]; }
+
+    // Degrees of separation between two users by bidirectional BFS: each round expands the smaller
+    // frontier by one level, and the first user reached from both sides closes a shortest path.
+    // Returns the number of hops (-1 if unreachable) and fills 'path' with the users along it.
+    int shortestPath(UserId from, UserId to, std::vector<UserId>& path) const {
+        path.clear();
+        if (from == to) {
+            path.push_back(from);
+            return 0;
+        }
+        std::vector<UserId> parentFromStart(userCount(), NO_USER);
+        std::vector<UserId> parentFromEnd(userCount(), NO_USER);
+        parentFromStart[from] = from;
+        parentFromEnd[to] = to;
+        std::vector<UserId> startFrontier(1, from);
+        std::vector<UserId> endFrontier(1, to);
+        std::vector<UserId> next;
+        UserId meeting = NO_USER;
+        while (meeting == NO_USER && !startFrontier.empty() && !endFrontier.empty()) {
+            bool forward = startFrontier.size() <= endFrontier.size();
+            std::vector<UserId>& frontier = forward ? startFrontier : endFrontier;
+            std::vector<UserId>& ownParents = forward ? parentFromStart : parentFromEnd;
+            const std::vector<UserId>& otherParents = forward ? parentFromEnd : parentFromStart;
+            next.clear();
+            for (size_t i = 0; i < frontier.size() && meeting == NO_USER; ++i) {
+                for (const UserId* it = friendsBegin(frontier[i]); it != friendsEnd(frontier[i]); ++it) {
+                    if (ownParents[*it] != NO_USER) {
+                        continue;
+                    }
+                    ownParents[*it] = frontier[i];
+                    if (otherParents[*it] != NO_USER) {
+                        meeting = *it;
+                        break;
+                    }
+                    next.push_back(*it);
+                }
+            }
+            frontier.swap(next);
+        }
+        if (meeting == NO_USER) {
+            return -1;
+        }
+        for (UserId user = meeting; user != from; user = parentFromStart[user]) {
+            path.push_back(user);
+        }
+        path.push_back(from);
+        std::reverse(path.begin(), path.end());
+        for (UserId user = meeting; user != to;) {
+            user = parentFromEnd[user];
+            path.push_back(user);
+        }
+        return static_cast<int>(path.size()) - 1;
+    }
+
+    // Number of users in the connected component (the "community") containing 'user'
+    size_t componentSize(UserId user) const {
+        ensureComponents();
+        return componentSizes[componentOf[user]];
+    }
+
+    // Number of connected components; a user without friends is a component of their own
+    size_t components() const {
+        ensureComponents();
+        return componentCount;
+    }
+
+    size_t largestComponentSize() const {
+        ensureComponents();
+        return largestComponent;
+    }
+};
+
+// --- Locking ---
+
+// Reader/writer lock (std::shared_mutex needs C++17). Where pthreads are not available it
+// degrades to a plain mutex, which is still correct, just without concurrent readers.
+class ReadWriteLock {
+private:
+#ifdef _WIN32
+    std::mutex mutex;
+#else
+    pthread_rwlock_t rwlock;
+#endif
+    ReadWriteLock(const ReadWriteLock&);            // Not copyable
+    ReadWriteLock& operator=(const ReadWriteLock&);
+
+public:
+#ifdef _WIN32
+    ReadWriteLock() {}
+    void lockShared() { mutex.lock(); }
+    void unlockShared() { mutex.unlock(); }
+    void lock() { mutex.lock(); }
+    void unlock() { mutex.unlock(); }
+#else
+    ReadWriteLock() { pthread_rwlock_init(&rwlock, NULL); }
+    ~ReadWriteLock() { pthread_rwlock_destroy(&rwlock); }
+    void lockShared() { pthread_rwlock_rdlock(&rwlock); }
+    void unlockShared() { pthread_rwlock_unlock(&rwlock); }
+    void lock() { pthread_rwlock_wrlock(&rwlock); }
+    void unlock() { pthread_rwlock_unlock(&rwlock); }
+#endif
+};
+
+// Holds a ReadWriteLock in shared mode for the lifetime of the guard
+class SharedGuard {
+private:
+    ReadWriteLock& rwlock;
+    SharedGuard(const SharedGuard&);
+    SharedGuard& operator=(const SharedGuard&);
+
+public:
+    explicit SharedGuard(ReadWriteLock& rwlock) : rwlock(rwlock) { rwlock.lockShared(); }
+    ~SharedGuard() { rwlock.unlockShared(); }
+};
+
+// Holds a ReadWriteLock in exclusive mode for the lifetime of the guard
+class ExclusiveGuard {
+private:
+    ReadWriteLock& rwlock;
+    ExclusiveGuard(const ExclusiveGuard&);
+    ExclusiveGuard& operator=(const ExclusiveGuard&);
+
+public:
+    explicit ExclusiveGuard(ReadWriteLock& rwlock) : rwlock(rwlock) { rwlock.lock(); }
+    ~ExclusiveGuard() { rwlock.unlock(); }
+};
+
+// --- Instrumentation ---
+
+// Operations with a latency histogram
+enum Metric {
+    METRIC_CREATE_USER,
+    METRIC_AUTHENTICATE,
+    METRIC_BEFRIEND,
+    METRIC_UNFRIEND,
+    METRIC_CREATE_POST,
+    METRIC_PROFILE_PAGE,
+    METRIC_FEED_PAGE,
+    METRIC_SEARCH,
+    METRIC_TRENDING,
+    METRIC_MUTUAL_FRIENDS,
+    METRIC_SUGGEST_FRIENDS,
+    METRIC_GRAPH_SNAPSHOT,
+    METRIC_SHORTEST_PATH,
+    METRIC_COMPONENTS,
+    METRIC_LOAD,
+    METRIC_SAVE,
+    METRIC_COMPACTION,
+    METRIC_GROUP_COMMIT,
+    METRIC_EXPORT_TEXT,
+    METRIC_COUNT
+};
+
+const char* metricName(Metric metric) {
+    switch (metric) {
+    case METRIC_CREATE_USER: return "createUser";
+    case METRIC_AUTHENTICATE: return "authenticate";
+    case METRIC_BEFRIEND: return "befriend";
+    case METRIC_UNFRIEND: return "unfriend";
+    case METRIC_CREATE_POST: return "createPost";
+    case METRIC_PROFILE_PAGE: return "profilePage";
+    case METRIC_FEED_PAGE: return "feedPage";
+    case METRIC_SEARCH: return "searchPage";
+    case METRIC_TRENDING: return "trending";
+    case METRIC_MUTUAL_FRIENDS: return "mutualFriends";
+    case METRIC_SUGGEST_FRIENDS: return "suggestFriends";
+    case METRIC_GRAPH_SNAPSHOT: return "graphSnapshot";
+    case METRIC_SHORTEST_PATH: return "shortestPath";
+    case METRIC_COMPONENTS: return "components";
+    case METRIC_LOAD: return "loadData";
+    case METRIC_SAVE: return "saveData";
+    case METRIC_COMPACTION: return "compaction";
+    case METRIC_GROUP_COMMIT: return "groupCommit";
+    case METRIC_EXPORT_TEXT: return "exportTextFiles";
+    default: return "unknown";
+    }
+}
+
+// Plain event counters; these are always kept
+enum Counter {
+    COUNTER_LOADS,
+    COUNTER_SAVES,
+    COUNTER_COMPACTIONS,
+    COUNTER_JOURNAL_RECORDS,
+    COUNTER_GROUP_COMMITS,
+    COUNTER_FSYNCS,
+    COUNTER_COLD_TIER_MOVES,
+    COUNTER_FEED_CACHE_HITS,
+    COUNTER_FEED_CACHE_MISSES,
+    COUNTER_FEED_FANOUT_PUSHES, // New posts added to cached feeds
+    COUNTER_FEED_CACHE_INVALIDATIONS,
+    COUNTER_BYTES_WRITTEN, // Journal, snapshots and text exports
+    COUNTER_COUNT
+};
+
+const char* counterName(Counter counter) {
+    switch (counter) {
+    case COUNTER_LOADS: return "loads";
+    case COUNTER_SAVES: return "saves";
+    case COUNTER_COMPACTIONS: return "compactions";
+    case COUNTER_JOURNAL_RECORDS: return "journal_records";
+    case COUNTER_GROUP_COMMITS: return "group_commits";
+    case COUNTER_FSYNCS: return "fsyncs";
+    case COUNTER_COLD_TIER_MOVES: return "cold_tier_moves";
+    case COUNTER_FEED_CACHE_HITS: return "feed_cache_hits";
+    case COUNTER_FEED_CACHE_MISSES: return "feed_cache_misses";
+    case COUNTER_FEED_FANOUT_PUSHES: return "feed_fanout_pushes";
+    case COUNTER_FEED_CACHE_INVALIDATIONS: return "feed_cache_invalidations";
+    case COUNTER_BYTES_WRITTEN: return "bytes_written";
+    default: return "unknown";
+    }
+}
+
+// Log-linear latency histogram in nanoseconds, in the style of HdrHistogram: every power of two is
+// split into 16 linear sub-buckets, so any recorded value is reported within ~6%. Recording is a
+// few relaxed atomic adds, safe from any thread.
+class LatencyHistogram {
+private:
+    static const int SUB_BUCKET_BITS = 4;
+    static const size_t SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+    static const size_t BUCKETS = 64 * SUB_BUCKETS;
+    std::atomic<uint64_t> buckets[BUCKETS];
+    std::atomic<uint64_t> total;
+    std::atomic<uint64_t> sum;
+    std::atomic<uint64_t> maximum;
+
+    static size_t bucketOf(uint64_t value) {
+        if (value < SUB_BUCKETS) {
+            return static_cast<size_t>(value);
+        }
+        int msb = 63;
+        while (!(value >> msb)) {
+            --msb;
+        }
+        size_t sub = static_cast<size_t>(value >> (msb - SUB_BUCKET_BITS)) & (SUB_BUCKETS - 1);
+        return (msb - SUB_BUCKET_BITS + 1) * SUB_BUCKETS + sub;
+    }
+
+    // Largest value that falls into 'bucket'
+    static uint64_t bucketLimit(size_t bucket) {
+        if (bucket < SUB_BUCKETS) {
+            return bucket;
+        }
+        int shift = static_cast<int>(bucket / SUB_BUCKETS) - 1;
+        uint64_t base = (SUB_BUCKETS + bucket % SUB_BUCKETS) << shift;
+        return base + ((uint64_t(1) << shift) - 1);
+    }
+
+public:
+    LatencyHistogram() : total(0), sum(0), maximum(0) {
+        for (size_t i = 0; i < BUCKETS; ++i) {
+            buckets[i] = 0;
+        }
+    }
+
+    void record(uint64_t nanos) {
+        buckets[bucketOf(nanos)].fetch_add(1, std::memory_order_relaxed);
+        total.fetch_add(1, std::memory_order_relaxed);
+        sum.fetch_add(nanos, std::memory_order_relaxed);
+        uint64_t seen = maximum.load(std::memory_order_relaxed);
+        while (nanos > seen && !maximum.compare_exchange_weak(seen, nanos, std::memory_order_relaxed)) {
+        }
+    }
+
+    uint64_t count() const { return total.load(std::memory_order_relaxed); }
+    uint64_t max() const { return maximum.load(std::memory_order_relaxed); }
+
+    uint64_t mean() const {
+        uint64_t n = count();
+        return n == 0 ? 0 : sum.load(std::memory_order_relaxed) / n;
+    }
+
+    // Upper bound of the value below which 'fraction' of the recorded values fall
+    uint64_t percentile(double fraction) const {
+        uint64_t n = count();
+        if (n == 0) {
+            return 0;
+        }
+        uint64_t rank = static_cast<uint64_t>(fraction * n + 0.5);
+        rank = std::max<uint64_t>(1, std::min(rank, n));
+        uint64_t seen = 0;
+        for (size_t i = 0; i < BUCKETS; ++i) {
+            seen += buckets[i].load(std::memory_order_relaxed);
+            if (seen >= rank) {
+                return std::min(bucketLimit(i), max());
+            }
+        }
+        return max();
+    }
+};
+
+// Approximate heap footprint of one data structure
+struct MemoryUsage {
+    std::string structure;
+    uint64_t bytes;
+
+    MemoryUsage(const std::string& structure, uint64_t bytes) : structure(structure), bytes(bytes) {}
+};
+
+// Process-wide statistics. Latency sampling is off unless enabled (then each timed operation
+// costs two clock reads); the counters are always kept since each event is one relaxed add.
+class Instrumentation {
+private:
+    std::atomic<bool> sampling;
+    LatencyHistogram latencies[METRIC_COUNT];
+    std::atomic<uint64_t> counters[COUNTER_COUNT];
+
+public:
+    std::string jsonFile; // Where the network dumps the statistics on exit; empty for no dump
+
+    Instrumentation() : sampling(false) {
+        for (size_t i = 0; i < COUNTER_COUNT; ++i) {
+            counters[i] = 0;
+        }
+    }
+
+    bool samplingEnabled() const { return sampling.load(std::memory_order_relaxed); }
+    void setSampling(bool enabled) { sampling = enabled; }
+
+    LatencyHistogram& latency(Metric metric) { return latencies[metric]; }
+    const LatencyHistogram& latency(Metric metric) const { return latencies[metric]; }
+
+    void add(Counter counter, uint64_t amount = 1) {
+        counters[counter].fetch_add(amount, std::memory_order_relaxed);
+    }
+
+    uint64_t get(Counter counter) const {
+        return counters[counter].load(std::memory_order_relaxed);
+    }
+
+    // Writes the statistics as one JSON object. Latencies are in microseconds.
+    void writeJson(std::ostream& out, const std::vector<MemoryUsage>& memory) const {
+        out << "{\n  \"sampling\": " << (samplingEnabled() ? "true" : "false") << ",\n  \"latency_us\": {";
+        for (int i = 0; i < METRIC_COUNT; ++i) {
+            const LatencyHistogram& histogram = latencies[i];
+            out << (i == 0 ? "\n" : ",\n") << "    \"" << metricName(static_cast<Metric>(i)) << "\": {\"count\": "
+                << histogram.count() << ", \"mean\": " << histogram.mean() / 1000.0 << ", \"p50\": "
+                << histogram.percentile(0.5) / 1000.0 << ", \"p99\": " << histogram.percentile(0.99) / 1000.0
+                << ", \"p999\": " << histogram.percentile(0.999) / 1000.0 << ", \"max\": " << histogram.max() / 1000.0 << "}";
+        }
+        out << "\n  },\n  \"counters\": {";
+        for (int i = 0; i < COUNTER_COUNT; ++i) {
+            out << (i == 0 ? "\n" : ",\n") << "    \"" << counterName(static_cast<Counter>(i)) << "\": " << get(static_cast<Counter>(i));
+        }
+        out << "\n  },\n  \"memory_bytes\": {";
+        for (size_t i = 0; i < memory.size(); ++i) {
+            out << (i == 0 ? "\n" : ",\n") << "    \"" << memory[i].structure << "\": " << memory[i].bytes;
+        }
+        out << "\n  }\n}\n";
+    }
+};
+
+Instrumentation instrumentation;
+
+// Records the lifetime of the guard in a latency histogram when sampling is on
+class ScopedLatency {
+private:
+    LatencyHistogram* histogram;
+    std::chrono::steady_clock::time_point start;
+    ScopedLatency(const ScopedLatency&);
+    ScopedLatency& operator=(const ScopedLatency&);
+
+public:
+    explicit ScopedLatency(Metric metric)
+        : histogram(instrumentation.samplingEnabled() ? &instrumentation.latency(metric) : NULL) {
+        if (histogram != NULL) {
+            start = std::chrono::steady_clock::now();
+        }
+    }
+
+    ~ScopedLatency() {
+        if (histogram != NULL) {
+            histogram->record(static_cast<uint64_t>(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count()));
+        }
+    }
+};
+
+// --- Feed Cache ---
+
+const size_t FEED_CACHE_POSTS = 64; // Newest feed posts materialized per cached user
+const size_t FEED_FANOUT_LIMIT = 1000; // Authors with more friends are pulled by their readers instead of fanned out to
+const size_t FEED_CACHE_SHARDS = 64; // Independently locked parts of the cache, by UserId
+
+// Materialized starts of users' feeds, so that reading a feed again is a copy of one page instead
+// of a merge over every friend's posts. The network keeps the cached feeds current:
+//  - A new post is pushed into the cached feeds of its author and the author's friends (fan-out on
+//    write). Authors with more than FEED_FANOUT_LIMIT friends are the exception: feeds list them as
+//    pulled authors and merge in their posts newer than the feed when it is read (pull on read).
+//  - A friendship change drops the two users' feeds; they are rebuilt on their next read.
+// Each shard evicts its least recently read feed when full. Shards have their own mutex and a
+// generation that every invalidation bumps, so a feed built from friend lists that changed while
+// it was being built is not stored.
+class FeedCache {
+private:
+    static const uint32_t NO_SLOT = 0xFFFFFFFFu;
+
+    struct Entry {
+        UserId user;
+        uint32_t newer; // Neighbouring slots in the shard's LRU list, NO_SLOT at the ends
+        uint32_t older;
+        bool complete;                   // Holds the whole feed: there is nothing older than handles.front()
+        PostHandle builtAt;              // Size of the post table when the feed was built
+        std::vector<PostHandle> handles; // Oldest first
+        std::vector<UserId> pulled;      // Authors whose posts from builtAt on are merged in when read
+    };
+
+    struct Shard {
+        std::mutex mutex;
+        std::vector<Entry> entries;
+        std::vector<uint32_t> slotOf; // Slot of each cached user, indexed by UserId / FEED_CACHE_SHARDS
+        std::vector<uint32_t> freeSlots;
+        uint32_t newest;
+        uint32_t oldest;
+        uint64_t generation;
+
+        Shard() : newest(NO_SLOT), oldest(NO_SLOT), generation(0) {}
+    };
+
+    Shard shards[FEED_CACHE_SHARDS];
+    size_t shardCapacity; // Feeds per shard; 0 disables the cache
+
+    FeedCache(const FeedCache&);            // Not copyable
+    FeedCache& operator=(const FeedCache&);
+
+    Shard& shardOf(UserId user) {
+        return shards[user % FEED_CACHE_SHARDS];
+    }
+
+    static uint32_t find(const Shard& shard, UserId user) {
+        size_t index = user / FEED_CACHE_SHARDS;
+        return index < shard.slotOf.size() ? shard.slotOf[index] : NO_SLOT;
+    }
+
+    static void unlink(Shard& shard, uint32_t slot) {
+        Entry& entry = shard.entries[slot];
+        if (entry.newer == NO_SLOT) {
+            shard.newest = entry.older;
+        } else {
+            shard.entries[entry.newer].older = entry.older;
+        }
+        if (entry.older == NO_SLOT) {
+            shard.oldest = entry.newer;
+        } else {
+            shard.entries[entry.older].newer = entry.newer;
+        }
+    }
+
+    static void linkNewest(Shard& shard, uint32_t slot) {
+        Entry& entry = shard.entries[slot];
+        entry.newer = NO_SLOT;
+        entry.older = shard.newest;
+        if (shard.newest == NO_SLOT) {
+            shard.oldest = slot;
+        } else {
+            shard.entries[shard.newest].newer = slot;
+        }
+        shard.newest = slot;
+    }
+
+    // Drops the feed in 'slot'; its vectors keep their capacity for the next feed stored there
+    static void release(Shard& shard, uint32_t slot) {
+        Entry& entry = shard.entries[slot];
+        unlink(shard, slot);
+        shard.slotOf[entry.user / FEED_CACHE_SHARDS] = NO_SLOT;
+        entry.handles.clear();
+        entry.pulled.clear();
+        shard.freeSlots.push_back(slot);
+    }
+
+    // Adds the posts of 'list' in [from, before) to a merge
+    static void addStream(std::priority_queue<FeedStream, std::vector<FeedStream>, CompareFeedStreams>& heap,
+                          const std::vector<PostHandle>& list, PostHandle from, PostHandle before) {
+        if (list.empty()) {
+            return;
+        }
+        FeedStream stream;
+        stream.begin = (from == 0) ? &list[0] : std::lower_bound(&list[0], &list[0] + list.size(), from);
+        stream.end = (before == NO_POST) ? &list[0] + list.size() : std::lower_bound(stream.begin, &list[0] + list.size(), before);
+        if (stream.end != stream.begin) {
+            heap.push(stream);
+        }
+    }
+
+public:
+    explicit FeedCache(size_t users) : shardCapacity((users + FEED_CACHE_SHARDS - 1) / FEED_CACHE_SHARDS) {}
+
+    bool enabled() const {
+        return shardCapacity != 0;
+    }
+
+    // Read before the friend lists a feed is built from; see store()
+    uint64_t generation(UserId user) {
+        Shard& shard = shardOf(user);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        return shard.generation;
+    }
+
+    // Copies up to 'limit' posts older than 'before' from the user's cached feed into 'page', newest
+    // first, and sets 'nextCursor' like SocialNetwork::feedPage. O(limit) for a feed without pulled
+    // authors. Returns false if the feed is not cached or the page reaches past the posts it holds.
+    bool read(UserId user, size_t limit, PostHandle before, const std::vector<std::vector<PostHandle> >& postsByAuthor,
+              std::vector<PostHandle>& page, PostHandle& nextCursor) {
+        if (!enabled()) {
+            return false;
+        }
+        Shard& shard = shardOf(user);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        uint32_t slot = find(shard, user);
+        if (slot == NO_SLOT) {
+            return false;
+        }
+        const Entry& entry = shard.entries[slot];
+        std::priority_queue<FeedStream, std::vector<FeedStream>, CompareFeedStreams> heap;
+        addStream(heap, entry.handles, 0, before);
+        for (size_t i = 0; i < entry.pulled.size(); ++i) {
+            addStream(heap, postsByAuthor[entry.pulled[i]], entry.builtAt, before);
+        }
+        // Every feed post from 'floor' on is in handles or a pulled author's newer posts
+        PostHandle floor = (entry.complete || entry.handles.empty()) ? 0 : entry.handles.front();
+        page.clear();
+        while (page.size() < limit && !heap.empty() && *(heap.top().end - 1) >= floor) {
+            FeedStream stream = heap.top();
+            heap.pop();
+            --stream.end;
+            page.push_back(*stream.end);
+            if (stream.end != stream.begin) {
+                heap.push(stream);
+            }
+        }
+        if (page.size() < limit && !entry.complete) {
+            return false;
+        }
+        nextCursor = (!page.empty() && (!entry.complete || !heap.empty())) ? page.back() : NO_POST;
+        unlink(shard, slot);
+        linkNewest(shard, slot);
+        return true;
+    }
+
+    // Caches the start of a user's feed, newest first, unless the shard was invalidated since
+    // generation(user) returned 'generation'. 'complete' says whether that is the whole feed.
+    void store(UserId user, uint64_t generation, const std::vector<PostHandle>& newestFirst, bool complete,
+               PostHandle builtAt, const std::vector<UserId>& pulled) {
+        if (!enabled()) {
+            return;
+        }
+        Shard& shard = shardOf(user);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        if (generation != shard.generation) {
+            return;
+        }
+        uint32_t slot = find(shard, user);
+        if (slot != NO_SLOT) {
+            release(shard, slot); // Another reader stored it first
+        }
+        if (!shard.freeSlots.empty()) {
+            slot = shard.freeSlots.back();
+            shard.freeSlots.pop_back();
+        } else if (shard.entries.size() < shardCapacity) {
+            slot = static_cast<uint32_t>(shard.entries.size());
+            shard.entries.push_back(Entry());
+        } else {
+            slot = shard.oldest; // Evict the least recently read feed
+            release(shard, slot);
+            shard.freeSlots.pop_back();
+        }
+        size_t index = user / FEED_CACHE_SHARDS;
+        if (index >= shard.slotOf.size()) {
+            shard.slotOf.resize(index + 1, static_cast<uint32_t>(NO_SLOT)); // A copy: NO_SLOT has no out-of-class definition
+        }
+        shard.slotOf[index] = slot;
+        Entry& entry = shard.entries[slot];
+        entry.user = user;
+        entry.complete = complete;
+        entry.builtAt = builtAt;
+        entry.handles.assign(newestFirst.rbegin(), newestFirst.rend());
+        entry.pulled = pulled;
+        linkNewest(shard, slot);
+    }
+
+    // Adds a new post to the user's feed if it is cached. Posts must arrive in handle order, which
+    // the network's exclusive lock on new posts ensures. Returns whether the feed was cached.
+    bool push(UserId user, PostHandle handle) {
+        if (!enabled()) {
+            return false;
+        }
+        Shard& shard = shardOf(user);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        uint32_t slot = find(shard, user);
+        if (slot == NO_SLOT) {
+            return false;
+        }
+        Entry& entry = shard.entries[slot];
+        entry.handles.push_back(handle);
+        if (entry.handles.size() > FEED_CACHE_POSTS) {
+            entry.handles.erase(entry.handles.begin());
+            entry.complete = false;
+        }
+        return true;
+    }
+
+    // Drops the user's feed, and makes feeds of the same shard that are being built stale.
+    // Returns whether the feed was cached.
+    bool invalidate(UserId user) {
+        if (!enabled()) {
+            return false;
+        }
+        Shard& shard = shardOf(user);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        ++shard.generation;
+        uint32_t slot = find(shard, user);
+        if (slot == NO_SLOT) {
+            return false;
+        }
+        release(shard, slot);
+        return true;
+    }
+
+    void clear() {
+        for (size_t i = 0; i < FEED_CACHE_SHARDS; ++i) {
+            Shard& shard = shards[i];
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            ++shard.generation;
+            std::vector<Entry>().swap(shard.entries);
+            std::vector<uint32_t>().swap(shard.slotOf);
+            std::vector<uint32_t>().swap(shard.freeSlots);
+            shard.newest = NO_SLOT;
+            shard.oldest = NO_SLOT;
+        }
+    }
+
+    uint64_t memoryBytes() {
+        uint64_t bytes = 0;
+        for (size_t i = 0; i < FEED_CACHE_SHARDS; ++i) {
+            Shard& shard = shards[i];
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            bytes += shard.entries.capacity() * sizeof(Entry)
+                + (shard.slotOf.capacity() + shard.freeSlots.capacity()) * sizeof(uint32_t);
+            for (size_t slot = 0; slot < shard.entries.size(); ++slot) {
+                bytes += shard.entries[slot].handles.capacity() * sizeof(PostHandle)
+                    + shard.entries[slot].pulled.capacity() * sizeof(UserId);
+            }
+        }
+        return bytes;
+    }
+};
+
+// --- Persistence ---
+
+// When a group commit counts as durable
+enum FsyncPolicy {
+    FSYNC_NEVER, // Handed to the OS only: survives a crash of the process, not of the machine
+    FSYNC_GROUP  // fsync after every group commit
+};
+
+struct PersistenceOptions {
+    int64_t flushIntervalMicros; // How long records may wait for company before a group commit
+    FsyncPolicy fsync;
+    size_t hotPosts; // Newest posts whose contents stay in memory; older ones are read from the snapshot
+    size_t feedCacheUsers; // Users whose feed is kept materialized (see FeedCache); 0 disables the cache
+    uint32_t shardIndex;   // This process's part of a sharded network (see ShardRouter): it only registers
+    uint32_t shardCount;   // the users it owns, and its post IDs carry the shard number
+
+    PersistenceOptions()
+        : flushIntervalMicros(2000), fsync(FSYNC_GROUP), hotPosts(1 << 18), feedCacheUsers(1 << 16), shardIndex(0), shardCount(1) {}
+};
+
+// Appends journal records on a background thread. Mutations only copy their record into the
+// pending buffer; the writer thread collects whatever arrived within the flush interval and
+// writes it with one write (and at most one fsync), so bursts of mutations share the disk cost.
+// Every group has a promise that is fulfilled once it is written, which is how callers that
+// need durability wait for it.
+class JournalWriter {
+private:
+    static const size_t MAX_GROUP_BYTES = 1 << 20; // A fuller buffer is committed without waiting for the interval
+
+    PersistenceOptions options;
+    std::string path;
+    std::FILE* file; // NULL while closed; records appended meanwhile stay pending until open()
+
+    // Lock order: fileMutex, then mutex. The writer holds fileMutex from taking a group until it is
+    // written, so groups reach the file in append order and close() never overtakes one.
+    std::mutex fileMutex;
+    std::mutex mutex; // Guards everything below (and 'file' for the writer's wait)
+    std::condition_variable wake;
+    std::string pending; // Records appended since the last group was taken
+    std::chrono::steady_clock::time_point pendingSince;
+    std::shared_ptr<std::promise<bool> > pendingPromise; // Fulfilled when 'pending' is written
+    std::shared_future<bool> pendingFuture;
+    std::shared_future<bool> lastFuture; // Of the group taken most recently
+    bool flushRequested; // A caller waits for the pending records; commit them without waiting for the interval
+    bool held;           // Batch mode: commit only when the buffer fills up or a caller waits
+    bool stopping;
+    std::thread thread;
+
+    JournalWriter(const JournalWriter&); // Not copyable
+    JournalWriter& operator=(const JournalWriter&);
+
+    static std::shared_future<bool> readyFuture(bool value) {
+        std::promise<bool> promise;
+        promise.set_value(value);
+        return promise.get_future().share();
+    }
+
+    // Writes one group to the file and makes it durable according to the fsync policy
+    bool writeGroup(const std::string& group) {
+        ScopedLatency timer(METRIC_GROUP_COMMIT);
+        bool ok = std::fwrite(group.data(), 1, group.size(), file) == group.size() && std::fflush(file) == 0;
+        if (ok && options.fsync == FSYNC_GROUP) {
+#ifdef _WIN32
+            ok = _commit(_fileno(file)) == 0;
+#else
+            ok = ::fsync(fileno(file)) == 0;
+#endif
+            instrumentation.add(COUNTER_FSYNCS);
+        }
+        if (!ok) {
+            std::cerr << "Error: Could not write to " << path << ".\n";
+            return false;
+        }
+        instrumentation.add(COUNTER_GROUP_COMMITS);
+        instrumentation.add(COUNTER_BYTES_WRITTEN, group.size());
+        return true;
+    }
+
+    // Takes the pending records and writes them. Callers hold fileMutex.
+    void commitPending() {
+        std::string group;
+        std::shared_ptr<std::promise<bool> > promise;
+        {
+            std::lock_guard<std::mutex> guard(mutex);
+            if (pending.empty() || file == NULL) {
+                return;
+            }
+            group.swap(pending);
+            promise.swap(pendingPromise);
+            lastFuture = pendingFuture;
+            pendingFuture = std::shared_future<bool>();
+            flushRequested = false;
+        }
+        promise->set_value(writeGroup(group));
+    }
+
+    // Body of the writer thread
+    void run() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            while (!stopping && (pending.empty() || file == NULL)) {
+                wake.wait(lock);
+            }
+            if (pending.empty() || file == NULL) {
+                break; // Stopping; the destructor drains what is left
+            }
+            // Let the group fill up for the flush interval
+            std::chrono::steady_clock::time_point deadline = pendingSince + std::chrono::microseconds(options.flushIntervalMicros);
+            while (!stopping && !flushRequested && pending.size() < MAX_GROUP_BYTES
+                   && (held || std::chrono::steady_clock::now() < deadline)) {
+                if (held) {
+                    wake.wait(lock);
+                } else {
+                    wake.wait_until(lock, deadline);
+                }
+            }
+            lock.unlock();
+            {
+                std::lock_guard<std::mutex> guard(fileMutex);
+                commitPending();
+            }
+            lock.lock();
+        }
+    }
+
+public:
+    explicit JournalWriter(const PersistenceOptions& options)
+        : options(options), file(NULL), flushRequested(false), held(false), stopping(false) {
+        thread = std::thread(&JournalWriter::run, this);
+    }
+
+    // Drains the pending records, then stops the writer thread
+    ~JournalWriter() {
+        {
+            std::lock_guard<std::mutex> guard(mutex);
+            stopping = true;
+        }
+        wake.notify_one();
+        thread.join();
+        close();
+    }
+
+    // Opens (or creates) the journal file; pending records go to it next
+    bool open(const std::string& journalPath, bool truncate) {
+        std::lock_guard<std::mutex> fileGuard(fileMutex);
+        std::FILE* opened = std::fopen(journalPath.c_str(), truncate ? "w" : "a");
+        {
+            std::lock_guard<std::mutex> guard(mutex);
+            path = journalPath;
+            file = opened;
+        }
+        wake.notify_one();
+        return opened != NULL;
+    }
+
+    // Writes everything pending to the current file and closes it. Returns false if a write failed.
+    bool close() {
+        std::lock_guard<std::mutex> fileGuard(fileMutex);
+        commitPending();
+        bool ok = lastFuture.valid() ? lastFuture.get() : true;
+        std::lock_guard<std::mutex> guard(mutex);
+        if (file != NULL) {
+            ok = std::fclose(file) == 0 && ok;
+            file = NULL;
+        }
+        return ok;
+    }
+
+    // Queues one record. Returns at once; the record is written with the next group commit.
+    void append(const std::string& record) {
+        bool wakeWriter = false;
+        {
+            std::lock_guard<std::mutex> guard(mutex);
+            if (pending.empty()) {
+                pendingSince = std::chrono::steady_clock::now();
+                pendingPromise = std::make_shared<std::promise<bool> >();
+                pendingFuture = pendingPromise->get_future().share();
+                wakeWriter = true; // Starts the flush interval; later records just join the group
+            }
+            pending += record;
+            pending += '\n';
+            wakeWriter = wakeWriter || pending.size() >= MAX_GROUP_BYTES;
+        }
+        if (wakeWriter) {
+            wake.notify_one();
+        }
+        instrumentation.add(COUNTER_JOURNAL_RECORDS);
+    }
+
+    // Future that becomes true once every record appended so far is durable (false if writing it
+    // failed). It resolves with the next regular group commit; pass commitNow to skip the wait.
+    std::shared_future<bool> durableFuture(bool commitNow = false) {
+        std::shared_future<bool> future;
+        {
+            std::lock_guard<std::mutex> guard(mutex);
+            if (!pending.empty()) {
+                future = pendingFuture;
+                flushRequested = flushRequested || commitNow;
+            } else {
+                future = lastFuture.valid() ? lastFuture : readyFuture(true);
+            }
+        }
+        wake.notify_one();
+        return future;
+    }
+
+    // While held, records are only committed when the buffer fills up, a caller asks for
+    // durability, or the hold ends
+    void hold(bool enable) {
+        {
+            std::lock_guard<std::mutex> guard(mutex);
+            held = enable;
+        }
+        wake.notify_one();
+    }
+};
+
+// --- SocialNetwork Class ---
+class SocialNetwork {
+private:
+    // Added space between > and > for older compilers (digraph issue)
+    std::vector<User> users; // Indexed by UserId
+    UserIndex userIndex; // Username -> UserId
+    std::vector<std::vector<UserId> > friendships; // Adjacency list, indexed by UserId; each list sorted and duplicate-free
+    std::vector<Post> posts; // In posting order, which is also ID order
+    PostIdGenerator postIds;
+    std::vector<std::vector<PostHandle> > postsByAuthor; // Per-author post handles in posting order, indexed by UserId
+    mutable FeedCache feedCache; // Materialized feeds, kept current by createPost and changeFriendship
+    std::vector<char> pulledAuthors; // Per user: posts are pulled by feed readers instead of fanned out.
+                                     // Only set under the exclusive tableLock.
+    StringArena text; // Bios and post contents; only ever appended to (or rebuilt, under an exclusive tableLock)
+
+    // Post tiers: the contents of the newest hotPostLimit posts are kept in the text arena. Older
+    // posts are cold: their contents are external arena blocks pointing into the mapped snapshot,
+    // so the OS only pages them in when someone pages back that far. Post metadata (author,
+    // timestamp, ID) stays in memory for every post; feeds, cursors and search need it.
+    size_t hotPostLimit;
+    MappedFile coldFile;   // The snapshot cold contents point into
+    size_t coldPosts;      // Posts [0, coldPosts) are cold
+    uint64_t coldBytes;    // Their content bytes
+    std::atomic<bool> coldTierStale; // A compaction wrote a snapshot that more posts can move to
+    SearchIndex searchIndex; // Post content terms to posts; maintained by addPost
+    mutable Trending trending; // Recent activity; fed by addPost
+    UserId loggedInUser; // ID of the currently logged-in user, or NO_USER
+    std::ostream* log; // Where load/save progress messages go
+    uint32_t shardIndex; // This process's part of a sharded network; 0 of 1 when not sharded
+    uint32_t shardCount;
+
+    // File names for data persistence
+    const std::string SNAPSHOT_FILE = "network.snap"; // Binary snapshot, see SnapshotHeader
+    const std::string USERS_FILE = "users.txt"; // Text files: import/export only
+    const std::string FRIENDSHIPS_FILE = "friendships.txt";
+    const std::string POSTS_FILE = "posts.txt";
+
+    // Write-ahead journal: every mutation appends one record here instead of rewriting the snapshot files.
+    // While a background compaction runs, the previous journal is parked under COMPACTING_JOURNAL_FILE.
+    const std::string JOURNAL_FILE = "journal.txt";
+    const std::string COMPACTING_JOURNAL_FILE = "journal.compacting.txt";
+    static const std::streamoff JOURNAL_COMPACT_THRESHOLD = 4 * 1024 * 1024; // Bytes of journal before a new snapshot is written
+
+    JournalWriter journal; // Group-commits the records on its own thread
+    std::atomic<int64_t> journalBytes; // Size of JOURNAL_FILE, used to decide when to compact
+    std::thread compactionThread;
+    std::atomic<bool> compactionRunning;
+    NetworkSnapshot compactionSnapshot; // Only touched by compactionThread while it runs
+
+    // Concurrency (server mode). Lock order: tableLock, then friend stripes by index.
+    //  - tableLock: exclusive while users or posts are added (the tables and per-author lists may
+    //    reallocate); shared for everything else. Readers hold it through a ReadGuard.
+    //  - friendLocks: stripes over UserId guarding the individual friend lists, so friend changes only
+    //    serialize with operations on the same stripes.
+    // Journal appends are serialized inside JournalWriter.
+    static const size_t FRIEND_LOCK_STRIPES = 64;
+    mutable ReadWriteLock tableLock;
+    mutable ReadWriteLock friendLocks[FRIEND_LOCK_STRIPES];
+
+    // Analytics snapshot of the friendship graph, rebuilt when graphVersion moved past it
+    std::atomic<uint64_t> graphVersion; // Bumped by every new user and friendship change
+    mutable std::mutex graphMutex;      // Guards the two members below
+    mutable std::shared_ptr<const FriendGraph> graphSnapshot;
+    mutable uint64_t graphSnapshotVersion;
+
+    // Cross-shard friendships whose half on this shard changed but whose other half has not been
+    // confirmed yet: (local user, remote stand-in) pairs. Each one is journaled as an intent record
+    // before the local half changes and cleared once the router settles it, so a half-applied
+    // change survives a crash of either shard or of the router until the router reconciles it.
+    // The snapshot does not hold them; each fresh journal starts with the ones still pending.
+    std::set<std::pair<UserId, UserId> > pendingLinks;
+    mutable std::mutex pendingMutex; // Guards pendingLinks; changed under tableLock (shared or exclusive)
+
+    ReadWriteLock& friendLock(UserId id) const {
+        return friendLocks[id % FRIEND_LOCK_STRIPES];
+    }
+
+    // Helper to find a user by username
+    // Made const to be callable from const member functions
+    User* findUser(const std::string& username) const { // Added const here
+        UserId id = findUserId(username);
+        if (id == NO_USER) {
+            return NULL; // Replaced nullptr with NULL
+        }
+        // Need to cast away constness if returning a non-const pointer
+        // A better design might be to return const User* or a copy if no modification is intended.
+        return const_cast<User*>(&users[id]);
+    }
+
+    // Helper to check if a user with the given username already exists
+    bool userExists(const std::string& username) const { // Added const here
+        return findUserId(username) != NO_USER;
+    }
+
+    // Interns a new user: assigns the next dense ID and indexes the name
+    UserId addUser(const User& user) {
+        UserId id = static_cast<UserId>(users.size());
+        users.push_back(user);
+        userIndex.insert(user.username, id);
+        friendships.push_back(std::vector<UserId>());
+        postsByAuthor.push_back(std::vector<PostHandle>());
+        pulledAuthors.push_back(0);
+        ++graphVersion;
+        return id;
+    }
+
+    // Returns true if the two users are friends: a binary search of the first user's sorted list, O(log d)
+    bool areFriends(UserId user1, UserId user2) const {
+        return std::binary_search(friendships[user1].begin(), friendships[user1].end(), user2);
+    }
+
+    // Records a friendship in both sorted lists. Returns false if they were already friends.
+    bool linkFriends(UserId user1, UserId user2) {
+        std::vector<UserId>& friends1 = friendships[user1];
+        std::vector<UserId>::iterator pos1 = std::lower_bound(friends1.begin(), friends1.end(), user2);
+        if (pos1 != friends1.end() && *pos1 == user2) {
+            return false;
+        }
+        friends1.insert(pos1, user2);
+        std::vector<UserId>& friends2 = friendships[user2];
+        friends2.insert(std::lower_bound(friends2.begin(), friends2.end(), user1), user1);
+        ++graphVersion;
+        return true;
+    }
+
+    // Removes a friendship from both sorted lists. Returns false if they were not friends.
+    bool unlinkFriends(UserId user1, UserId user2) {
+        std::vector<UserId>& friends1 = friendships[user1];
+        std::vector<UserId>::iterator pos1 = std::lower_bound(friends1.begin(), friends1.end(), user2);
+        if (pos1 == friends1.end() || *pos1 != user2) {
+            return false;
+        }
+        friends1.erase(pos1);
+        std::vector<UserId>& friends2 = friendships[user2];
+        std::vector<UserId>::iterator pos2 = std::lower_bound(friends2.begin(), friends2.end(), user1);
+        if (pos2 != friends2.end() && *pos2 == user1) {
+            friends2.erase(pos2);
+        }
+        ++graphVersion;
+        return true;
+    }
+
+    // Sorts and deduplicates every friend list after a bulk load that appended edges unordered
+    void normalizeFriendships() {
+        for (size_t i = 0; i < friendships.size(); ++i) {
+            std::vector<UserId>& friends = friendships[i];
+            if (!std::is_sorted(friends.begin(), friends.end())) {
+                std::sort(friends.begin(), friends.end());
+            }
+            friends.erase(std::unique(friends.begin(), friends.end()), friends.end());
+        }
+    }
+
+    // Appends a post and records it in its author's index, the search index and the trending counters.
+    // Every post is passed through here, so the ID generator stays ahead of all loaded IDs.
+    PostHandle addPost(Post post) {
+        if (!posts.empty() && post.postId <= posts.back().postId) {
+            post.postId = postIds.next(); // A duplicate from merged sources: IDs stay unique and in table order
+        }
+        postIds.observe(post.postId);
+        PostHandle handle = static_cast<PostHandle>(posts.size());
+        posts.push_back(post);
+        postsByAuthor[post.author].push_back(handle);
+        searchIndex.add(handle, text.data(post.content), post.content.length);
+        trending.add(post.timestamp, post.author, text.data(post.content), post.content.length);
+        return handle;
+    }
+
+    // Text loader step run by parallelFor: looks up the username fields of friendship and post chunks.
+    // Chunks [firstChunk, firstPostChunk) are friendships (two names per line), the rest are posts.
+    struct ResolveUsernames {
+        const SocialNetwork* network;
+        std::vector<TextChunk>* chunks;
+        size_t firstChunk;
+        size_t firstPostChunk;
+
+        void operator()(size_t index) const {
+            TextChunk& chunk = (*chunks)[firstChunk + index];
+            bool isPost = firstChunk + index >= firstPostChunk;
+            size_t lines = chunk.fields.size() / chunk.fieldsPerLine;
+            chunk.ids.reserve(isPost ? lines : lines * 2);
+            for (size_t line = 0; line < lines; ++line) {
+                const TextRef* fields = &chunk.fields[line * chunk.fieldsPerLine];
+                if (isPost) {
+                    chunk.ids.push_back(network->userIndex.find(fields[1].data, fields[1].length, network->users));
+                } else {
+                    chunk.ids.push_back(network->userIndex.find(fields[0].data, fields[0].length, network->users));
+                    chunk.ids.push_back(network->userIndex.find(fields[1].data, fields[1].length, network->users));
+                }
+            }
+        }
+    };
+
+    // Post of the text import, ordered by ID before it is added; posts without an ID go last
+    struct ImportedPost {
+        uint64_t id;
+        UserId author;
+        const TextRef* line;
+    };
+
+    struct CompareImportedPosts {
+        bool operator()(const ImportedPost& a, const ImportedPost& b) const {
+            return (a.id - 1) < (b.id - 1); // 0 wraps around to the largest value
+        }
+    };
+
+    // Heap bytes behind a string; short strings live inside the object itself
+    static uint64_t stringHeapBytes(const std::string& str) {
+        static const size_t inlineCapacity = std::string().capacity();
+        return str.capacity() > inlineCapacity ? str.capacity() + 1 : 0;
+    }
+
+public:
+    // Constructor: loads data from files when the SocialNetwork object is created.
+    // Progress messages go to 'log' (batch mode keeps stdout for results).
+    explicit SocialNetwork(std::ostream& log = std::cout, const PersistenceOptions& persistence = PersistenceOptions())
+        : feedCache(persistence.feedCacheUsers), hotPostLimit(persistence.hotPosts), coldPosts(0), coldBytes(0), coldTierStale(false),
+          loggedInUser(NO_USER), log(&log), shardIndex(persistence.shardIndex), shardCount(persistence.shardCount),
+          journal(persistence), journalBytes(0), compactionRunning(false), graphVersion(0), graphSnapshotVersion(0) {
+        postIds.setShard(shardIndex);
+        loadData();
+    }
+
+    // Destructor: waits for any background compaction and writes out the queued journal records
+    ~SocialNetwork() {
+        waitForCompaction();
+        if (!journal.close()) {
+            std::cerr << "Error: Some journal records could not be written to " << JOURNAL_FILE << ".\n";
+        }
+        if (!instrumentation.jsonFile.empty()) {
+            std::ofstream statsFile(instrumentation.jsonFile.c_str());
+            instrumentation.writeJson(statsFile, memoryUsage());
+            if (!statsFile) {
+                std::cerr << "Error: Could not write " << instrumentation.jsonFile << ".\n";
+            }
+        }
+    }
+
+    // --- Data Management (Load/Save) ---
+
+    // Loads the network: the binary snapshot if there is one (the text files otherwise), then the journal
+    void loadData() {
+        ScopedLatency timer(METRIC_LOAD);
+        instrumentation.add(COUNTER_LOADS);
+        bool migrateText = false;
+        if (!loadSnapshot()) {
+            migrateText = importTextFiles();
+        }
+
+        // Replay the journal on top of the snapshot. Its records may already be in the snapshot: after
+        // an interrupted compaction (a leftover compacting journal), or a crash between writing the
+        // snapshot and truncating the journal. Replay is idempotent. Posts are sorted by ID and every
+        // later post gets a greater ID, so journaled posts up to the newest loaded one are skipped.
+        std::set<uint64_t> knownPostIds;
+        uint64_t snapshotPostId = posts.empty() ? 0 : posts.back().postId;
+        std::ifstream compactingFile(COMPACTING_JOURNAL_FILE.c_str());
+        bool interruptedCompaction = compactingFile.is_open();
+        if (interruptedCompaction) {
+            replayJournal(compactingFile, snapshotPostId, knownPostIds);
+            compactingFile.close();
+        }
+        std::ifstream journalFile(JOURNAL_FILE.c_str());
+        if (journalFile.is_open()) {
+            journalBytes = replayJournal(journalFile, snapshotPostId, knownPostIds);
+            journalFile.close();
+            *log << "Journal replayed from " << JOURNAL_FILE << "\n";
+        }
+
+        if (!journal.open(JOURNAL_FILE, false)) {
+            std::cerr << "Error: Could not open " << JOURNAL_FILE << " for writing.\n";
+        }
+        if (interruptedCompaction || migrateText) {
+            saveData(); // Finish the interrupted compaction / write the first binary snapshot
+        }
+    }
+
+    // Replaces the in-memory state with the contents of the text files.
+    // All three files are mapped and split into line-aligned chunks that are parsed in parallel
+    // (fields stay views into the mapping), then merged in file order. Returns true if at least
+    // one of the files existed.
+    bool importTextFiles() {
+        waitForCompaction(); // It may still be reading the arena
+        text.clear();
+        coldFile.close();
+        coldPosts = 0;
+        coldBytes = 0;
+        searchIndex.clear();
+        trending.clear();
+        users.clear();
+        userIndex.clear();
+        friendships.clear();
+        posts.clear();
+        postsByAuthor.clear();
+        pulledAuthors.clear();
+        pendingLinks.clear();
+        feedCache.clear();
+
+        MappedFile userFile, friendshipFile, postFile;
+        bool haveUsers = userFile.open(USERS_FILE);
+        bool haveFriendships = friendshipFile.open(FRIENDSHIPS_FILE);
+        bool havePosts = postFile.open(POSTS_FILE);
+
+        // Parse: chunks of all three files go through the same pool, so the files load concurrently
+        size_t targetChunks = 4 * std::max(1u, std::thread::hardware_concurrency());
+        std::vector<TextChunk> chunks;
+        splitIntoChunks(userFile, 3, targetChunks, chunks); // username|password|bio
+        size_t firstFriendshipChunk = chunks.size();
+        splitIntoChunks(friendshipFile, 2, targetChunks, chunks); // user1|user2
+        size_t firstPostChunk = chunks.size();
+        splitIntoChunks(postFile, 4, targetChunks, chunks); // postId|username|timestamp|content
+        ParseTextChunks parse = { &chunks };
+        parallelFor(chunks.size(), parse);
+
+        // Merge users in file order; later lines with a name already seen are skipped
+        for (size_t c = 0; c < firstFriendshipChunk; ++c) {
+            const std::vector<TextRef>& fields = chunks[c].fields;
+            for (size_t i = 0; i + 2 < fields.size(); i += 3) {
+                if (userIndex.find(fields[i].data, fields[i].length, users) == NO_USER) {
+                    addUser(User(fields[i].str(), fields[i + 1].str(), text.append(fields[i + 2].data, fields[i + 2].length)));
+                }
+            }
+        }
+
+        // Resolve the usernames of friendships and posts in parallel; the user index is read-only now
+        ResolveUsernames resolve = { this, &chunks, firstFriendshipChunk, firstPostChunk };
+        parallelFor(chunks.size() - firstFriendshipChunk, resolve);
+
+        for (size_t c = firstFriendshipChunk; c < firstPostChunk; ++c) {
+            const std::vector<UserId>& ids = chunks[c].ids;
+            for (size_t i = 0; i + 1 < ids.size(); i += 2) {
+                if (ids[i] == NO_USER || ids[i + 1] == NO_USER) {
+                    continue; // Friendship with a user that no longer exists
+                }
+                friendships[ids[i]].push_back(ids[i + 1]);
+                friendships[ids[i + 1]].push_back(ids[i]); // Friendships are mutual
+            }
+        }
+        normalizeFriendships(); // The file may list an edge in either or both directions
+
+        // Posts are added in ID order, which is their creation order (and file order, unless the file
+        // was merged from several sources)
+        std::vector<ImportedPost> imported;
+        for (size_t c = firstPostChunk; c < chunks.size(); ++c) {
+            const std::vector<TextRef>& fields = chunks[c].fields;
+            const std::vector<UserId>& ids = chunks[c].ids;
+            for (size_t i = 0; i < ids.size(); ++i) {
+                if (ids[i] == NO_USER) {
+                    continue; // Post by a user that no longer exists
+                }
+                ImportedPost post = { parsePostId(fields[i * 4].data, fields[i * 4].length), ids[i], &fields[i * 4] };
+                imported.push_back(post);
+            }
+        }
+        CompareImportedPosts byId;
+        if (!std::is_sorted(imported.begin(), imported.end(), byId)) {
+            std::stable_sort(imported.begin(), imported.end(), byId);
+        }
+        // An ID that occurs again (the same post from two sources, or a clash) keeps its first
+        // post; the others are moved to the end and get new IDs
+        std::vector<ImportedPost> duplicates;
+        size_t kept = 0;
+        for (size_t i = 0; i < imported.size(); ++i) {
+            if (kept > 0 && imported[i].id != 0 && imported[i].id == imported[kept - 1].id) {
+                imported[i].id = 0;
+                duplicates.push_back(imported[i]);
+            } else {
+                imported[kept++] = imported[i];
+            }
+        }
+        imported.resize(kept);
+        imported.insert(imported.end(), duplicates.begin(), duplicates.end());
+        posts.reserve(imported.size());
+        for (size_t i = 0; i < imported.size(); ++i) {
+            const TextRef* line = imported[i].line;
+            Timestamp timestamp = parseTimestamp(line[2].str()); // Also accepts the old formatted timestamps
+            observeTimestamp(timestamp);
+            uint64_t id = imported[i].id != 0 ? imported[i].id : postIds.next();
+            addPost(Post(id, imported[i].author, text.append(line[3].data, line[3].length), timestamp));
+        }
+
+        *log << (haveUsers ? "Users loaded from " + USERS_FILE : std::string("No existing users file found. Creating new one.")) << "\n";
+        *log << (haveFriendships ? "Friendships loaded from " + FRIENDSHIPS_FILE : std::string("No existing friendships file found. Creating new one.")) << "\n";
+        *log << (havePosts ? "Posts loaded from " + POSTS_FILE : std::string("No existing posts file found. Creating new one.")) << "\n";
+        return haveUsers || haveFriendships || havePosts;
+    }
+
+    // Writes the current state to the text files (export path; the binary snapshot is the primary copy)
+    bool exportTextFiles() const {
+        ScopedLatency timer(METRIC_EXPORT_TEXT);
+        bool ok = writeTextFiles(users, friendships, posts, text.view());
+        if (ok) {
+            *log << "Data exported to " << USERS_FILE << ", " << FRIENDSHIPS_FILE << " and " << POSTS_FILE << "\n";
+        }
+        return ok;
+    }
+
+    // Writes a full snapshot of the current state synchronously and empties the journal
+    void saveData() {
+        ScopedLatency timer(METRIC_SAVE);
+        ExclusiveGuard guard(tableLock);
+        waitForCompaction();
+        if (!writeSnapshot(users, friendships, posts, text.view())) {
+            return; // Keep the journal, it is still needed to rebuild the state
+        }
+        journal.close(); // Its queued records are in the snapshot as well
+        journal.open(JOURNAL_FILE, true);
+        journalBytes = 0;
+        journalPendingLinks();
+        std::remove(COMPACTING_JOURNAL_FILE.c_str());
+        instrumentation.add(COUNTER_SAVES);
+        *log << "Data saved to " << SNAPSHOT_FILE << "\n";
+        moveToColdTier();
+    }
+
+private:
+    // --- Snapshot ---
+
+    // Snapshot writer step run by parallelFor: encodes the columns of one post segment
+    struct EncodeSegments {
+        const std::vector<Post>* posts;
+        std::vector<SnapshotSegment>* entries;
+        std::vector<SegmentColumns>* columns;
+
+        void operator()(size_t index) const {
+            size_t begin = index * POSTS_PER_SEGMENT;
+            size_t end = std::min(begin + POSTS_PER_SEGMENT, posts->size());
+            encodeSegment(*posts, begin, end, (*entries)[index], (*columns)[index]);
+        }
+    };
+
+    // Snapshot loader step run by parallelFor: decodes one post segment
+    struct DecodeSegments {
+        const char* base;
+        const SnapshotSegment* entries;
+        std::vector<DecodedSegment>* segments;
+
+        void operator()(size_t index) const {
+            decodeSegment(base, entries[index], (*segments)[index]);
+        }
+    };
+
+    // Moves an unusable snapshot aside to SNAPSHOT_FILE + ".corrupt" rather than overwriting it
+    void setAsideSnapshot() {
+        std::string corruptName = SNAPSHOT_FILE + ".corrupt";
+        if (replaceFile(SNAPSHOT_FILE, corruptName)) {
+            std::cerr << "Moved the unusable snapshot to " << corruptName << "; falling back to the text files.\n";
+        }
+    }
+
+    // Maps the binary snapshot and rebuilds the in-memory tables from its records and post segments.
+    // Returns false if there is no usable snapshot (the caller then imports the text files).
+    bool loadSnapshot() {
+        MappedFile file;
+        if (!file.open(SNAPSHOT_FILE)) {
+            return false;
+        }
+        if (!validSnapshot(file)) {
+            file.close();
+            setAsideSnapshot();
+            return false;
+        }
+        const char* base = file.data();
+        SnapshotHeader header;
+        std::memcpy(&header, base, sizeof(header));
+
+        // Post segments decode independently, so they are decoded in parallel before anything is added
+        SnapshotSegmentTable table;
+        std::memcpy(&table, base + header.postsOffset, sizeof(table));
+        const SnapshotSegment* segmentEntries = reinterpret_cast<const SnapshotSegment*>(base + header.postsOffset + sizeof(table));
+        std::vector<DecodedSegment> segments(static_cast<size_t>(table.segmentCount));
+        DecodeSegments decode = { base, segmentEntries, &segments };
+        parallelFor(segments.size(), decode);
+        for (size_t i = 0; i < segments.size(); ++i) {
+            if (!segments[i].ok) {
+                std::cerr << "Error: " << SNAPSHOT_FILE << " has a malformed post segment.\n";
+                file.close();
+                setAsideSnapshot();
+                return false;
+            }
+        }
+
+        const SnapshotUser* userRecords = reinterpret_cast<const SnapshotUser*>(base + header.usersOffset);
+        const SnapshotEdge* edgeRecords = reinterpret_cast<const SnapshotEdge*>(base + header.edgesOffset);
+        const char* strings = base + header.stringsOffset;
+        uint64_t stringsSize = header.stringsSize;
+
+        users.reserve(header.userCount);
+        friendships.reserve(header.userCount);
+        postsByAuthor.reserve(header.userCount);
+        for (uint64_t i = 0; i < header.userCount; ++i) {
+            addUser(User(snapshotString(strings, stringsSize, userRecords[i].username),
+                         snapshotString(strings, stringsSize, userRecords[i].password),
+                         snapshotText(strings, stringsSize, userRecords[i].bio)));
+        }
+        for (uint64_t i = 0; i < header.edgeCount; ++i) {
+            UserId user1 = edgeRecords[i].user1;
+            UserId user2 = edgeRecords[i].user2;
+            if (user1 < users.size() && user2 < users.size()) {
+                friendships[user1].push_back(user2);
+                friendships[user2].push_back(user1); // Friendships are mutual
+            }
+        }
+        normalizeFriendships(); // Edges are stored by ascending ID, so this is a linear check
+        posts.reserve(header.postCount);
+        // All but the newest hotPostLimit posts stay in the mapped file (the cold tier)
+        uint64_t coldTarget = header.postCount > hotPostLimit ? header.postCount - hotPostLimit : 0;
+        uint64_t index = 0;
+        for (size_t s = 0; s < segments.size(); ++s) {
+            const DecodedSegment& segment = segments[s];
+            observeTimestamp(segmentEntries[s].maxTimestamp);
+            uint32_t block = index < coldTarget ? text.addExternal(segment.contents) : 0;
+            uint32_t offset = 0;
+            for (size_t i = 0; i < segment.authors.size(); ++i, ++index) {
+                if (segment.authors[i] < users.size()) {
+                    ArenaString content;
+                    if (index < coldTarget) {
+                        content = ArenaString(block, offset, segment.lengths[i]);
+                        ++coldPosts;
+                        coldBytes += segment.lengths[i];
+                    } else {
+                        content = text.append(segment.contents + offset, segment.lengths[i]);
+                    }
+                    addPost(Post(segment.postIds[i], segment.authors[i], content, segment.timestamps[i]));
+                }
+                offset += segment.lengths[i];
+            }
+        }
+        if (coldPosts > 0) {
+            coldFile.swap(file); // Keep the mapping; drop what loading touched from the resident set
+            coldFile.evictResident();
+        }
+        *log << "Snapshot loaded from " << SNAPSHOT_FILE << " (" << users.size() << " users, "
+                  << posts.size() << " posts)\n";
+        return true;
+    }
+
+    // Checks the header, the section layout and the body checksum of a mapped snapshot
+    bool validSnapshot(const MappedFile& file) const {
+        const char* base = file.data();
+        SnapshotHeader header;
+        if (file.size() < sizeof(header)) {
+            std::cerr << "Error: " << SNAPSHOT_FILE << " is truncated.\n";
+            return false;
+        }
+        std::memcpy(&header, base, sizeof(header));
+
+        Checksum64 headerChecksum;
+        headerChecksum.update(&header, offsetof(SnapshotHeader, headerChecksum));
+        if (std::memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) != 0 ||
+            header.byteOrder != SNAPSHOT_BYTE_ORDER || headerChecksum.finish() != header.headerChecksum) {
+            std::cerr << "Error: " << SNAPSHOT_FILE << " is not a valid snapshot.\n";
+            return false;
+        }
+        if (header.version != SNAPSHOT_VERSION) {
+            std::cerr << "Error: " << SNAPSHOT_FILE << " has unsupported version " << header.version << ".\n";
+            return false;
+        }
+        if (header.fileSize != file.size() ||
+            header.usersOffset + header.userCount * sizeof(SnapshotUser) > header.edgesOffset ||
+            header.edgesOffset + header.edgeCount * sizeof(SnapshotEdge) > header.postsOffset ||
+            header.postsOffset > header.stringsOffset || // The segments are checked below
+            header.stringsOffset + header.stringsSize > header.fileSize) {
+            std::cerr << "Error: " << SNAPSHOT_FILE << " has an inconsistent layout.\n";
+            return false;
+        }
+        if (!validSegmentDirectory(base, header)) {
+            std::cerr << "Error: " << SNAPSHOT_FILE << " has an inconsistent post segment directory.\n";
+            return false;
+        }
+        Checksum64 bodyChecksum;
+        bodyChecksum.update(base + sizeof(header), file.size() - sizeof(header));
+        if (bodyChecksum.finish() != header.bodyChecksum) {
+            std::cerr << "Error: " << SNAPSHOT_FILE << " is corrupt (checksum mismatch).\n";
+            return false;
+        }
+        return true;
+    }
+
+    // Checks that every post segment lies between the directory and the string heap, that its
+    // columns fit inside it, and that the segments hold postCount posts in total
+    static bool validSegmentDirectory(const char* base, const SnapshotHeader& header) {
+        SnapshotSegmentTable table;
+        if (header.postsOffset + sizeof(table) > header.stringsOffset) {
+            return false;
+        }
+        std::memcpy(&table, base + header.postsOffset, sizeof(table));
+        uint64_t dataStart = header.postsOffset + sizeof(table);
+        if (table.segmentCount > (header.stringsOffset - dataStart) / sizeof(SnapshotSegment)) {
+            return false;
+        }
+        const SnapshotSegment* entries = reinterpret_cast<const SnapshotSegment*>(base + dataStart);
+        dataStart += table.segmentCount * sizeof(SnapshotSegment);
+        uint64_t postCount = 0;
+        for (uint64_t i = 0; i < table.segmentCount; ++i) {
+            const SnapshotSegment& entry = entries[i];
+            uint64_t columnBytes = static_cast<uint64_t>(entry.authorBytes) + entry.timestampBytes + entry.postIdBytes + entry.lengthBytes;
+            if (entry.offset < dataStart || entry.offset > header.stringsOffset || entry.size > header.stringsOffset - entry.offset ||
+                columnBytes > entry.size || entry.postCount == 0 || entry.postCount > POSTS_PER_SEGMENT) {
+                return false;
+            }
+            postCount += entry.postCount;
+        }
+        return postCount == header.postCount;
+    }
+
+    // Resolves a SnapshotString against the string heap (empty if it points outside the heap)
+    static std::string snapshotString(const char* strings, uint64_t stringsSize, const SnapshotString& ref) {
+        if (ref.offset > stringsSize || ref.length > stringsSize - ref.offset) {
+            return std::string();
+        }
+        return std::string(strings + ref.offset, ref.length);
+    }
+
+    // Copies a string of the snapshot heap straight into the text arena
+    ArenaString snapshotText(const char* strings, uint64_t stringsSize, const SnapshotString& ref) {
+        if (ref.offset > stringsSize || ref.length > stringsSize - ref.offset) {
+            return ArenaString();
+        }
+        return text.append(strings + ref.offset, ref.length);
+    }
+
+    // Builds a SnapshotString for 'length' bytes at the end of the string heap and advances the heap size
+    static SnapshotString placeString(size_t length, uint64_t& heapSize) {
+        SnapshotString ref;
+        ref.offset = heapSize;
+        ref.length = static_cast<uint32_t>(length);
+        ref.reserved = 0;
+        heapSize += length;
+        return ref;
+    }
+
+    // Writes bytes to the snapshot file and feeds them to the body checksum
+    static void writeChecksummed(std::ofstream& out, Checksum64& checksum, const void* data, size_t length) {
+        out.write(static_cast<const char*>(data), length);
+        checksum.update(data, length);
+    }
+
+    // Writes the binary snapshot to a temporary file and renames it over SNAPSHOT_FILE, so a crash
+    // never leaves a half-written snapshot behind. Runs on the compaction thread, so it only
+    // touches the tables it is given.
+    bool writeSnapshot(const std::vector<User>& snapUsers, const std::vector<std::vector<UserId> >& snapFriendships,
+                       const std::vector<Post>& snapPosts, const ArenaView& snapText) const {
+        std::string snapshotTmp = SNAPSHOT_FILE + ".tmp";
+        std::ofstream out(snapshotTmp.c_str(), std::ios::binary | std::ios::trunc);
+        if (!out.is_open()) {
+            std::cerr << "Error: Could not open " << snapshotTmp << " for writing.\n";
+            return false;
+        }
+
+        SnapshotHeader header;
+        std::memset(&header, 0, sizeof(header));
+        std::memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+        header.version = SNAPSHOT_VERSION;
+        header.byteOrder = SNAPSHOT_BYTE_ORDER;
+        header.userCount = snapUsers.size();
+        for (UserId user = 0; user < snapFriendships.size(); ++user) {
+            // Each friendship is stored once, from its lower ID; lists are sorted, so that is a suffix
+            const std::vector<UserId>& friends = snapFriendships[user];
+            header.edgeCount += friends.end() - std::upper_bound(friends.begin(), friends.end(), user);
+        }
+        header.postCount = snapPosts.size();
+        header.usersOffset = sizeof(header);
+        header.edgesOffset = header.usersOffset + header.userCount * sizeof(SnapshotUser);
+        header.postsOffset = header.edgesOffset + header.edgeCount * sizeof(SnapshotEdge);
+
+        // Encode the small segment columns first (in parallel), so the directory can go in front of the segments
+        size_t segmentCount = (snapPosts.size() + POSTS_PER_SEGMENT - 1) / POSTS_PER_SEGMENT;
+        std::vector<SnapshotSegment> segments(segmentCount);
+        std::vector<SegmentColumns> columns(segmentCount);
+        EncodeSegments encode = { &snapPosts, &segments, &columns };
+        parallelFor(segmentCount, encode);
+        uint64_t segmentOffset = header.postsOffset + sizeof(SnapshotSegmentTable) + segmentCount * sizeof(SnapshotSegment);
+        for (size_t i = 0; i < segmentCount; ++i) {
+            segments[i].offset = segmentOffset;
+            segmentOffset += segments[i].size;
+        }
+        header.stringsOffset = (segmentOffset + 7) & ~static_cast<uint64_t>(7);
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header)); // Placeholder, rewritten at the end
+
+        Checksum64 checksum;
+        uint64_t heapSize = 0;
+        for (size_t i = 0; i < snapUsers.size(); ++i) {
+            SnapshotUser record;
+            record.username = placeString(snapUsers[i].username.size(), heapSize);
+            record.password = placeString(snapUsers[i].password.size(), heapSize);
+            record.bio = placeString(snapUsers[i].bio.length, heapSize);
+            writeChecksummed(out, checksum, &record, sizeof(record));
+        }
+        for (UserId user = 0; user < snapFriendships.size(); ++user) {
+            const std::vector<UserId>& friends = snapFriendships[user];
+            for (std::vector<UserId>::const_iterator it = std::upper_bound(friends.begin(), friends.end(), user); it != friends.end(); ++it) {
+                SnapshotEdge record;
+                record.user1 = user;
+                record.user2 = *it;
+                writeChecksummed(out, checksum, &record, sizeof(record));
+            }
+        }
+        SnapshotSegmentTable table = { segmentCount, 0 };
+        writeChecksummed(out, checksum, &table, sizeof(table));
+        if (segmentCount > 0) {
+            writeChecksummed(out, checksum, &segments[0], segmentCount * sizeof(SnapshotSegment));
+        }
+        for (size_t i = 0; i < segmentCount; ++i) {
+            writeChecksummed(out, checksum, columns[i].authors.data(), columns[i].authors.size());
+            writeChecksummed(out, checksum, columns[i].timestamps.data(), columns[i].timestamps.size());
+            writeChecksummed(out, checksum, columns[i].postIds.data(), columns[i].postIds.size());
+            writeChecksummed(out, checksum, columns[i].lengths.data(), columns[i].lengths.size());
+            size_t end = std::min((i + 1) * POSTS_PER_SEGMENT, snapPosts.size());
+            for (size_t post = i * POSTS_PER_SEGMENT; post < end; ++post) {
+                writeChecksummed(out, checksum, snapText.data(snapPosts[post].content), snapPosts[post].content.length);
+            }
+            columns[i] = SegmentColumns(); // Written; release it early
+        }
+        static const char padding[8] = { 0 };
+        writeChecksummed(out, checksum, padding, header.stringsOffset - segmentOffset);
+        // String heap, in the same order the records above reserved their offsets
+        for (size_t i = 0; i < snapUsers.size(); ++i) {
+            writeChecksummed(out, checksum, snapUsers[i].username.data(), snapUsers[i].username.size());
+            writeChecksummed(out, checksum, snapUsers[i].password.data(), snapUsers[i].password.size());
+            writeChecksummed(out, checksum, snapText.data(snapUsers[i].bio), snapUsers[i].bio.length);
+        }
+
+        header.stringsSize = heapSize;
+        header.fileSize = header.stringsOffset + heapSize;
+        header.bodyChecksum = checksum.finish();
+        Checksum64 headerChecksum;
+        headerChecksum.update(&header, offsetof(SnapshotHeader, headerChecksum));
+        header.headerChecksum = headerChecksum.finish();
+        out.seekp(0);
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.close();
+        if (!out) {
+            std::cerr << "Error: Could not write " << snapshotTmp << ".\n";
+            return false;
+        }
+        instrumentation.add(COUNTER_BYTES_WRITTEN, header.fileSize);
+        return replaceFile(snapshotTmp, SNAPSHOT_FILE);
+    }
+
+    // Writes users, friendships and posts to the pipe-delimited text files.
+    // Each file is written to a temporary name and then renamed over the old one.
+    bool writeTextFiles(const std::vector<User>& snapUsers, const std::vector<std::vector<UserId> >& snapFriendships,
+                        const std::vector<Post>& snapPosts, const ArenaView& snapText) const {
+        bool ok = true;
+
+        // Save Users
+        std::string usersTmp = USERS_FILE + ".tmp";
+        std::ofstream userFile(usersTmp.c_str());
+        if (userFile.is_open()) {
+            for (size_t i = 0; i < snapUsers.size(); ++i) {
+                userFile << snapUsers[i].username << "|" << snapUsers[i].password << "|" << sanitizeString(snapText.str(snapUsers[i].bio)) << "\n";
+            }
+            instrumentation.add(COUNTER_BYTES_WRITTEN, static_cast<uint64_t>(userFile.tellp()));
+            userFile.close();
+            ok = replaceFile(usersTmp, USERS_FILE) && ok;
+        } else {
+            std::cerr << "Error: Could not open " << usersTmp << " for writing.\n";
+            ok = false;
+        }
+
+        // Save Friendships: one pass over the adjacency lists, writing each edge once from its lower ID
+        // (A|B but not B|A), so there is no need to remember which pairs were already written
+        std::string friendshipsTmp = FRIENDSHIPS_FILE + ".tmp";
+        std::ofstream friendshipFile(friendshipsTmp.c_str());
+        if (friendshipFile.is_open()) {
+            for (UserId user1 = 0; user1 < snapFriendships.size(); ++user1) {
+                const std::vector<UserId>& friends = snapFriendships[user1];
+                // Lists are sorted, so the friends with a higher ID are a suffix
+                for (std::vector<UserId>::const_iterator it = std::upper_bound(friends.begin(), friends.end(), user1); it != friends.end(); ++it) {
+                    friendshipFile << snapUsers[user1].username << "|" << snapUsers[*it].username << "\n";
+                }
+            }
+            instrumentation.add(COUNTER_BYTES_WRITTEN, static_cast<uint64_t>(friendshipFile.tellp()));
+            friendshipFile.close();
+            ok = replaceFile(friendshipsTmp, FRIENDSHIPS_FILE) && ok;
+        } else {
+            std::cerr << "Error: Could not open " << friendshipsTmp << " for writing.\n";
+            ok = false;
+        }
+
+        // Save Posts
+        std::string postsTmp = POSTS_FILE + ".tmp";
+        std::ofstream postFile(postsTmp.c_str());
+        if (postFile.is_open()) {
+            for (size_t i = 0; i < snapPosts.size(); ++i) { // Changed to index-based loop
+                postFile << formatPostId(snapPosts[i].postId) << "|" << snapUsers[snapPosts[i].author].username << "|" << snapPosts[i].timestamp << "|" << sanitizeString(snapText.str(snapPosts[i].content)) << "\n";
+            }
+            instrumentation.add(COUNTER_BYTES_WRITTEN, static_cast<uint64_t>(postFile.tellp()));
+            postFile.close();
+            ok = replaceFile(postsTmp, POSTS_FILE) && ok;
+        } else {
+            std::cerr << "Error: Could not open " << postsTmp << " for writing.\n";
+            ok = false;
+        }
+        return ok;
+    }
+
+    // --- Journal ---
+
+    // Renames 'from' over 'to'. std::rename replaces the target atomically on POSIX;
+    // other platforms refuse to overwrite, so fall back to removing the target first.
+    static bool replaceFile(const std::string& from, const std::string& to) {
+        if (std::rename(from.c_str(), to.c_str()) == 0) {
+            return true;
+        }
+        std::remove(to.c_str());
+        if (std::rename(from.c_str(), to.c_str()) == 0) {
+            return true;
+        }
+        std::cerr << "Error: Could not replace " << to << ".\n";
+        return false;
+    }
+
+    // Applies every record in a journal stream to the in-memory state and returns the bytes read.
+    // Records are idempotent: users and posts that already exist and friendships that already
+    // match are skipped, so a journal can safely be replayed over a snapshot that contains it.
+    // Posts with IDs up to 'loadedPostId' are in the snapshot; 'knownPostIds' collects the others.
+    std::streamoff replayJournal(std::istream& in, uint64_t loadedPostId, std::set<uint64_t>& knownPostIds) {
+        std::streamoff bytes = 0;
+        std::string line;
+        while (std::getline(in, line)) {
+            bytes += static_cast<std::streamoff>(line.size()) + 1;
+            std::stringstream ss(line);
+            std::string type;
+            std::getline(ss, type, '|');
+            if (type == "U") {
+                std::string username, password, bio;
+                std::getline(ss, username, '|');
+                std::getline(ss, password, '|');
+                std::getline(ss, bio);
+                if (!userExists(username)) {
+                    addUser(User(username, password, text.append(bio)));
+                }
+            } else if (type == "F" || type == "R") {
+                std::string name1, name2;
+                std::getline(ss, name1, '|');
+                std::getline(ss, name2);
+                UserId user1 = findUserId(name1);
+                UserId user2 = findUserId(name2);
+                if (user1 == NO_USER || user2 == NO_USER) {
+                    continue;
+                }
+                if (type == "F") {
+                    linkFriends(user1, user2);
+                } else {
+                    unlinkFriends(user1, user2);
+                }
+            } else if (type == "I" || type == "S") { // Cross-shard intent recorded / settled
+                std::string name1, name2;
+                std::getline(ss, name1, '|');
+                std::getline(ss, name2);
+                UserId user1 = findUserId(name1);
+                UserId user2 = findUserId(name2);
+                if (user1 == NO_USER || user2 == NO_USER) {
+                    continue;
+                }
+                if (type == "I") {
+                    pendingLinks.insert(std::make_pair(user1, user2));
+                } else {
+                    pendingLinks.erase(std::make_pair(user1, user2));
+                }
+            } else if (type == "P") {
+                std::string postId, username, timestamp, content;
+                std::getline(ss, postId, '|');
+                std::getline(ss, username, '|');
+                std::getline(ss, timestamp, '|');
+                std::getline(ss, content);
+                UserId author = findUserId(username);
+                uint64_t id = parsePostId(postId);
+                if (author != NO_USER && (id == 0 || (id > loadedPostId && knownPostIds.insert(id).second))) {
+                    Timestamp parsed = parseTimestamp(timestamp);
+                    observeTimestamp(parsed);
+                    addPost(Post(id != 0 ? id : postIds.next(), author, text.append(content), parsed));
+                }
+            }
+            // Unknown record types are skipped so older binaries can read newer journals
+        }
+        return bytes;
+    }
+
+    // Queues one record for the journal writer. Callers hold tableLock (shared or exclusive), so the
+    // journal cannot be parked or truncated underneath them.
+    void appendJournal(const std::string& record) {
+        journal.append(record);
+        journalBytes += static_cast<int64_t>(record.size()) + 1;
+    }
+
+    // Starts a fresh journal with the intents still pending. Callers hold tableLock exclusively.
+    void journalPendingLinks() {
+        std::lock_guard<std::mutex> pendingGuard(pendingMutex);
+        std::set<std::pair<UserId, UserId> >::const_iterator it;
+        for (it = pendingLinks.begin(); it != pendingLinks.end(); ++it) {
+            appendJournal("I|" + users[it->first].username + "|" + users[it->second].username);
+        }
+    }
+
+    // Moves old posts to the cold tier once a compaction has finished, and kicks off a background
+    // compaction once the journal has grown too large. Called by the mutating operations after they
+    // released their locks, since both need tableLock exclusively.
+    void compactIfNeeded() {
+        if (coldTierStale && !compactionRunning) {
+            ExclusiveGuard guard(tableLock);
+            if (coldTierStale && !compactionRunning) {
+                waitForCompaction(); // Reap the finished thread; it may still hold a view of the arena
+                moveToColdTier();
+            }
+        }
+        if (journalBytes < JOURNAL_COMPACT_THRESHOLD || compactionRunning) {
+            return;
+        }
+        ExclusiveGuard guard(tableLock);
+        if (journalBytes >= JOURNAL_COMPACT_THRESHOLD) {
+            startCompaction();
+        }
+    }
+
+    // Parks the current journal, copies the in-memory state, and writes the snapshot on a
+    // background thread. New mutations go to a fresh journal in the meantime.
+    void startCompaction() {
+        if (compactionRunning) {
+            return; // The running compaction will be followed by another once the journal grows again
+        }
+        waitForCompaction(); // Reap the previous, already finished thread
+        journal.close(); // Queued records belong to the journal being parked
+        if (!replaceFile(JOURNAL_FILE, COMPACTING_JOURNAL_FILE)) {
+            journal.open(JOURNAL_FILE, false);
+            return;
+        }
+        journal.open(JOURNAL_FILE, true);
+        journalBytes = 0;
+        journalPendingLinks();
+
+        compactionSnapshot.users = users;
+        compactionSnapshot.friendships = friendships;
+        compactionSnapshot.posts = posts;
+        compactionSnapshot.text = text.view(); // Shares the arena blocks instead of copying the text
+        compactionRunning = true;
+        compactionThread = std::thread(&SocialNetwork::runCompaction, this);
+    }
+
+    // Body of the compaction thread
+    void runCompaction() {
+        {
+            ScopedLatency timer(METRIC_COMPACTION);
+            if (writeSnapshot(compactionSnapshot.users, compactionSnapshot.friendships, compactionSnapshot.posts, compactionSnapshot.text)) {
+                std::remove(COMPACTING_JOURNAL_FILE.c_str()); // Its records are now part of the snapshot
+                instrumentation.add(COUNTER_COMPACTIONS);
+                coldTierStale = true;
+            }
+        }
+        compactionRunning = false;
+    }
+
+    // Blocks until the background compaction (if any) has finished
+    void waitForCompaction() {
+        if (compactionThread.joinable()) {
+            compactionThread.join();
+        }
+        compactionSnapshot = NetworkSnapshot();
+    }
+
+    // --- Post Tiers ---
+
+    // Moves all but the newest hotPostLimit posts to the cold tier. Every snapshot holds the oldest
+    // posts in handle order, so after one is written their contents can be pointed into it; the text
+    // arena is then rebuilt with only the bios and the hot contents, which frees the old blocks.
+    // Called with tableLock held exclusively right after a snapshot was written (no compaction running).
+    void moveToColdTier() {
+        coldTierStale = false;
+        if (posts.size() <= hotPostLimit || posts.size() - hotPostLimit <= coldPosts) {
+            return; // Nothing new to demote
+        }
+        MappedFile file;
+        SnapshotHeader header;
+        if (!file.open(SNAPSHOT_FILE) || file.size() < sizeof(header)) {
+            return;
+        }
+        const char* base = file.data();
+        std::memcpy(&header, base, sizeof(header));
+        if (std::memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) != 0 || header.version != SNAPSHOT_VERSION ||
+            header.fileSize != file.size() || header.stringsOffset > header.fileSize || header.postCount > posts.size() ||
+            !validSegmentDirectory(base, header)) {
+            return;
+        }
+        SnapshotSegmentTable table;
+        std::memcpy(&table, base + header.postsOffset, sizeof(table));
+        const SnapshotSegment* entries = reinterpret_cast<const SnapshotSegment*>(base + header.postsOffset + sizeof(table));
+
+        // The snapshot must hold exactly our oldest posts: compare each segment's ID range and content size
+        size_t first = 0;
+        for (uint64_t s = 0; s < table.segmentCount; ++s) {
+            const SnapshotSegment& entry = entries[s];
+            size_t end = first + static_cast<size_t>(entry.postCount);
+            uint64_t contentBytes = 0;
+            for (size_t handle = first; handle < end; ++handle) {
+                contentBytes += posts[handle].content.length;
+            }
+            uint64_t columnBytes = static_cast<uint64_t>(entry.authorBytes) + entry.timestampBytes + entry.postIdBytes + entry.lengthBytes;
+            if (posts[first].postId != entry.firstPostId || posts[end - 1].postId != entry.lastPostId ||
+                contentBytes != entry.size - columnBytes) {
+                std::cerr << "Warning: " << SNAPSHOT_FILE << " does not match the post table; old posts stay in memory.\n";
+                return;
+            }
+            first = end;
+        }
+
+        size_t coldTarget = std::min(static_cast<size_t>(header.postCount), posts.size() - hotPostLimit);
+        StringArena rebuilt;
+        for (size_t i = 0; i < users.size(); ++i) {
+            users[i].bio = rebuilt.append(text.data(users[i].bio), users[i].bio.length);
+        }
+        coldPosts = 0;
+        coldBytes = 0;
+        first = 0;
+        for (uint64_t s = 0; s < table.segmentCount; ++s) {
+            const SnapshotSegment& entry = entries[s];
+            size_t end = first + static_cast<size_t>(entry.postCount);
+            uint64_t columnBytes = static_cast<uint64_t>(entry.authorBytes) + entry.timestampBytes + entry.postIdBytes + entry.lengthBytes;
+            uint32_t block = first < coldTarget ? rebuilt.addExternal(base + entry.offset + columnBytes) : 0;
+            uint32_t offset = 0;
+            for (size_t handle = first; handle < end; ++handle) {
+                ArenaString& content = posts[handle].content;
+                uint32_t length = content.length;
+                if (handle < coldTarget) {
+                    content = ArenaString(block, offset, length);
+                    ++coldPosts;
+                    coldBytes += length;
+                } else {
+                    content = rebuilt.append(text.data(content), length);
+                }
+                offset += length;
+            }
+            first = end;
+        }
+        for (size_t handle = first; handle < posts.size(); ++handle) {
+            posts[handle].content = rebuilt.append(text.data(posts[handle].content), posts[handle].content.length);
+        }
+        text.swap(rebuilt);  // 'rebuilt' now holds the old blocks and frees them on return
+        coldFile.swap(file); // Likewise the previous mapping
+        coldFile.evictResident();
+        instrumentation.add(COUNTER_COLD_TIER_MOVES);
+    }
+
+    // Shared body of befriend/unfriend. Only the friend lists of the two users change, so this runs
+    // under a shared tableLock plus the two users' friend stripes.
+    OpStatus changeFriendship(UserId user, UserId friendId, bool link) {
+        OpStatus status = OP_OK;
+        {
+            SharedGuard guard(tableLock);
+            if (user >= users.size() || friendId >= users.size()) {
+                return OP_NO_SUCH_USER;
+            }
+            if (user == friendId) {
+                return link ? OP_SELF_FRIEND : OP_NOT_FRIENDS;
+            }
+            // Lock the two stripes in index order so concurrent changes cannot deadlock
+            size_t stripe1 = std::min(user % FRIEND_LOCK_STRIPES, friendId % FRIEND_LOCK_STRIPES);
+            size_t stripe2 = std::max(user % FRIEND_LOCK_STRIPES, friendId % FRIEND_LOCK_STRIPES);
+            ExclusiveGuard first(friendLocks[stripe1]);
+            if (stripe2 != stripe1) {
+                friendLocks[stripe2].lock();
+            }
+            if (link ? linkFriends(user, friendId) : unlinkFriends(user, friendId)) {
+                // Log the changed friendship
+                appendJournal(std::string(link ? "F|" : "R|") + users[user].username + "|" + users[friendId].username);
+                invalidateFeed(user); // Rebuilt from the new friend lists on their next read
+                invalidateFeed(friendId);
+            } else {
+                status = link ? OP_ALREADY_FRIENDS : OP_NOT_FRIENDS; // Fails if already friends to avoid duplicates
+            }
+            if (stripe2 != stripe1) {
+                friendLocks[stripe2].unlock();
+            }
+        }
+        compactIfNeeded();
+        return status;
+    }
+
+    // The k-way merge behind feedPage, over the posts of 'user' and 'friends'
+    std::vector<PostHandle> mergeFeed(UserId user, const std::vector<UserId>& friends, size_t limit, PostHandle before,
+                                      PostHandle& nextCursor) const {
+        std::priority_queue<FeedStream, std::vector<FeedStream>, CompareFeedStreams> heap;
+        for (size_t i = 0; i <= friends.size(); ++i) {
+            const std::vector<PostHandle>& authored = postsByAuthor[i < friends.size() ? friends[i] : user]; // Always include own posts in the feed
+            if (authored.empty()) {
+                continue;
+            }
+            FeedStream stream;
+            stream.begin = &authored[0];
+            stream.end = (before == NO_POST) ? stream.begin + authored.size()
+                : std::lower_bound(stream.begin, stream.begin + authored.size(), before);
+            if (stream.end != stream.begin) {
+                heap.push(stream);
+            }
+        }
+
+        std::vector<PostHandle> page;
+        while (page.size() < limit && !heap.empty()) {
+            FeedStream stream = heap.top();
+            heap.pop();
+            --stream.end;
+            page.push_back(*stream.end);
+            if (stream.end != stream.begin) {
+                heap.push(stream);
+            }
+        }
+        nextCursor = (!heap.empty() && !page.empty()) ? page.back() : NO_POST;
+        return page;
+    }
+
+    void invalidateFeed(UserId user) {
+        if (feedCache.invalidate(user)) {
+            instrumentation.add(COUNTER_FEED_CACHE_INVALIDATIONS);
+        }
+    }
+
+    // Pushes a new post into the cached feeds of its author and the author's friends. An author with
+    // more than FEED_FANOUT_LIMIT friends is switched to pull for good: the cached feeds that would
+    // miss their later posts are dropped, and rebuilt feeds merge those posts in when read.
+    // Needs the exclusive tableLock.
+    void fanOutPost(PostHandle handle) {
+        if (!feedCache.enabled()) {
+            return;
+        }
+        UserId author = posts[handle].author;
+        const std::vector<UserId>& friends = friendships[author];
+        if (!pulledAuthors[author] && friends.size() > FEED_FANOUT_LIMIT) {
+            pulledAuthors[author] = 1;
+            invalidateFeed(author);
+            for (size_t i = 0; i < friends.size(); ++i) {
+                invalidateFeed(friends[i]);
+            }
+        }
+        if (pulledAuthors[author]) {
+            return;
+        }
+        uint64_t pushes = feedCache.push(author, handle) ? 1 : 0;
+        for (size_t i = 0; i < friends.size(); ++i) {
+            pushes += feedCache.push(friends[i], handle) ? 1 : 0;
+        }
+        instrumentation.add(COUNTER_FEED_FANOUT_PUSHES, pushes);
+    }
+
+public:
+    // --- Core Operations ---
+    // These validate their input and report an OpStatus instead of prompting or printing, so the
+    // interactive menu and batch mode share one implementation.
+
+    // Registers a new user. Names and passwords may not be empty or contain whitespace or '|'.
+    OpStatus createUser(const std::string& username, const std::string& password, const std::string& bio) {
+        ScopedLatency timer(METRIC_CREATE_USER);
+        if (!validToken(username) || !validToken(password)) {
+            return OP_INVALID_ARGUMENT;
+        }
+        if (shardOfUser(username, shardCount) != shardIndex) {
+            return OP_WRONG_SHARD;
+        }
+        {
+            ExclusiveGuard guard(tableLock);
+            if (userExists(username)) {
+                return OP_USER_EXISTS;
+            }
+            addUser(User(username, password, text.append(bio)));
+            appendJournal("U|" + username + "|" + password + "|" + sanitizeString(bio)); // Log the new user instead of rewriting every file
+        }
+        compactIfNeeded();
+        return OP_OK;
+    }
+
+    // Checks a username/password pair and returns the user's ID through 'id'
+    OpStatus authenticate(const std::string& username, const std::string& password, UserId& id) const {
+        ScopedLatency timer(METRIC_AUTHENTICATE);
+        SharedGuard guard(tableLock);
+        id = findUserId(username);
+        if (id == NO_USER || users[id].isRemote() || users[id].password != password) {
+            id = NO_USER;
+            return OP_BAD_CREDENTIALS;
+        }
+        return OP_OK;
+    }
+
+    // Makes two users friends (mutual relationship)
+    OpStatus befriend(UserId user, UserId friendId) {
+        ScopedLatency timer(METRIC_BEFRIEND);
+        return changeFriendship(user, friendId, true);
+    }
+
+    // Ends a friendship on both sides
+    OpStatus unfriend(UserId user, UserId friendId) {
+        ScopedLatency timer(METRIC_UNFRIEND);
+        return changeFriendship(user, friendId, false);
+    }
+
+    // This shard's half of a friendship between one of its users and 'remoteName', a user of
+    // another shard (the router changes the other half there). The remote user is represented by
+    // a stand-in (see User::isRemote) that is created on first use.
+    OpStatus changeRemoteFriendship(UserId user, const std::string& remoteName, bool link) {
+        if (!validToken(remoteName) || shardOfUser(remoteName, shardCount) == shardIndex) {
+            return OP_INVALID_ARGUMENT;
+        }
+        UserId remote;
+        {
+            SharedGuard guard(tableLock);
+            if (user >= users.size() || users[user].isRemote()) {
+                return OP_NO_SUCH_USER;
+            }
+            remote = findUserId(remoteName);
+        }
+        if (remote == NO_USER && !link) {
+            return OP_NOT_FRIENDS;
+        }
+        if (remote == NO_USER) {
+            ExclusiveGuard guard(tableLock);
+            remote = findUserId(remoteName);
+            if (remote == NO_USER) {
+                remote = addUser(User(remoteName, "", text.append("")));
+                appendJournal("U|" + remoteName + "||");
+            }
+        }
+        {
+            SharedGuard guard(tableLock);
+            std::lock_guard<std::mutex> pendingGuard(pendingMutex);
+            if (pendingLinks.insert(std::make_pair(user, remote)).second) {
+                appendJournal("I|" + users[user].username + "|" + remoteName); // Intent first, see pendingLinks
+            }
+        }
+        return link ? befriend(user, remote) : unfriend(user, remote);
+    }
+
+    // Clears the intent for the pair: the router confirmed that the remote half matches this one.
+    // Settling a pair that is not pending does nothing.
+    OpStatus settleRemoteFriendship(UserId user, const std::string& remoteName) {
+        SharedGuard guard(tableLock);
+        UserId remote = findUserId(remoteName);
+        if (user >= users.size() || remote == NO_USER) {
+            return OP_NO_SUCH_USER;
+        }
+        std::lock_guard<std::mutex> pendingGuard(pendingMutex);
+        if (pendingLinks.erase(std::make_pair(user, remote)) != 0) {
+            appendJournal("S|" + users[user].username + "|" + remoteName);
+        }
+        return OP_OK;
+    }
+
+    // Publishes a post; content longer than MAX_POST_LENGTH is truncated. 'handle' receives the new post.
+    OpStatus createPost(UserId author, const std::string& content, PostHandle& handle) {
+        ScopedLatency timer(METRIC_CREATE_POST);
+        {
+            ExclusiveGuard guard(tableLock);
+            if (author >= users.size()) {
+                return OP_NO_SUCH_USER;
+            }
+            std::string truncated = content.substr(0, MAX_POST_LENGTH);
+            Post post(postIds.next(), author, text.append(truncated), nextTimestamp());
+            handle = addPost(post);
+            fanOutPost(handle);
+            appendJournal("P|" + formatPostId(post.postId) + "|" + users[post.author].username + "|" + toString(post.timestamp) + "|" + sanitizeString(truncated)); // Log the new post
+        }
+        compactIfNeeded();
+        return OP_OK;
+    }
+
+    // --- Queries ---
+    // When other threads may be mutating, hold a ReadGuard while calling these and while using
+    // the references they return. The mutating operations above take their own locks.
+
+    // Holds the network's table lock in shared mode: users and posts cannot be added meanwhile
+    class ReadGuard {
+    private:
+        SharedGuard guard;
+
+    public:
+        explicit ReadGuard(const SocialNetwork& network) : guard(network.tableLock) {}
+    };
+
+    // Helper to look up a user's ID through the hash index
+    UserId findUserId(const std::string& username) const {
+        return userIndex.find(username, users);
+    }
+
+    const User& getUser(UserId id) const {
+        return users[id];
+    }
+
+    const Post& getPost(PostHandle handle) const {
+        return posts[handle];
+    }
+
+    struct ComparePostId {
+        bool operator()(const Post& post, uint64_t id) const {
+            return post.postId < id;
+        }
+    };
+
+    // Turns a post ID into a pagination cursor: the handle of the first post with that ID or a newer
+    // one, so pages continue strictly before 'postId'. The ID does not have to exist here; any
+    // point in time works, including an ID from another shard.
+    PostHandle postCursor(uint64_t postId) const {
+        return static_cast<PostHandle>(std::lower_bound(posts.begin(), posts.end(), postId, ComparePostId()) - posts.begin());
+    }
+
+    // Bytes of a bio or post content; valid for str.length bytes while the ReadGuard is held
+    const char* getText(const ArenaString& str) const {
+        return text.data(str);
+    }
+
+    // Approximate heap bytes held by each table, including the strings and nested vectors they own
+    std::vector<MemoryUsage> memoryUsage() const {
+        uint64_t userBytes = users.capacity() * sizeof(User);
+        for (size_t i = 0; i < users.size(); ++i) {
+            userBytes += stringHeapBytes(users[i].username) + stringHeapBytes(users[i].password);
+        }
+        uint64_t friendshipBytes = friendships.capacity() * sizeof(std::vector<UserId>);
+        for (size_t stripe = 0; stripe < FRIEND_LOCK_STRIPES; ++stripe) {
+            SharedGuard guard(friendLocks[stripe]); // Friend lists may change under a ReadGuard
+            for (size_t id = stripe; id < friendships.size(); id += FRIEND_LOCK_STRIPES) {
+                friendshipBytes += friendships[id].capacity() * sizeof(UserId);
+            }
+        }
+        uint64_t postBytes = posts.capacity() * sizeof(Post);
+        uint64_t authorIndexBytes = postsByAuthor.capacity() * sizeof(std::vector<PostHandle>);
+        for (size_t i = 0; i < postsByAuthor.size(); ++i) {
+            authorIndexBytes += postsByAuthor[i].capacity() * sizeof(PostHandle);
+        }
+
+        std::vector<MemoryUsage> usage;
+        usage.push_back(MemoryUsage("users", userBytes));
+        usage.push_back(MemoryUsage("user_index", userIndex.memoryBytes()));
+        usage.push_back(MemoryUsage("friendships", friendshipBytes));
+        usage.push_back(MemoryUsage("posts", postBytes));
+        usage.push_back(MemoryUsage("posts_by_author", authorIndexBytes));
+        usage.push_back(MemoryUsage("text_arena", text.memoryBytes()));
+        usage.push_back(MemoryUsage("search_index", searchIndex.memoryBytes()));
+        uint64_t feedCacheBytes = feedCache.memoryBytes() + pulledAuthors.capacity();
+        usage.push_back(MemoryUsage("feed_cache", feedCacheBytes));
+        uint64_t trendingBytes = trending.memoryBytes();
+        usage.push_back(MemoryUsage("trending", trendingBytes));
+        usage.push_back(MemoryUsage("total", userBytes + userIndex.memoryBytes() + friendshipBytes + postBytes + authorIndexBytes
+                                                 + text.memoryBytes() + searchIndex.memoryBytes() + feedCacheBytes + trendingBytes));
+        usage.push_back(MemoryUsage("cold_post_contents", coldBytes)); // Mapped, not heap: not part of the total
+        return usage;
+    }
+
+    // Number of hot and cold posts (see hotPostLimit)
+    void tierSizes(size_t& hot, size_t& cold) const {
+        cold = coldPosts;
+        hot = posts.size() - coldPosts;
+    }
+
+    // Copy of the user's sorted friend list
+    std::vector<UserId> getFriends(UserId id) const {
+        SharedGuard guard(friendLock(id));
+        return friendships[id];
+    }
+
+    // A cross-shard friendship that still waits for the router (see pendingLinks), with the
+    // current state of this shard's half
+    struct PendingLink {
+        UserId user;
+        UserId remote;
+        bool linked;
+    };
+
+    // The pending cross-shard friendships of one user (of every user if 'user' is NO_USER)
+    std::vector<PendingLink> pendingRemoteFriendships(UserId user) const {
+        std::vector<std::pair<UserId, UserId> > pairs;
+        {
+            std::lock_guard<std::mutex> pendingGuard(pendingMutex);
+            std::set<std::pair<UserId, UserId> >::const_iterator it = pendingLinks.begin();
+            if (user != NO_USER) {
+                it = pendingLinks.lower_bound(std::make_pair(user, static_cast<UserId>(0)));
+            }
+            for (; it != pendingLinks.end() && (user == NO_USER || it->first == user); ++it) {
+                pairs.push_back(*it);
+            }
+        }
+        std::vector<PendingLink> pending;
+        for (size_t i = 0; i < pairs.size(); ++i) {
+            SharedGuard guard(friendLock(pairs[i].first));
+            PendingLink entry = { pairs[i].first, pairs[i].second, areFriends(pairs[i].first, pairs[i].second) };
+            pending.push_back(entry);
+        }
+        return pending;
+    }
+
+    // The other shards that own friends of the user, in ascending order: where the router finds
+    // the rest of the user's feed
+    std::vector<uint32_t> friendShards(UserId id) const {
+        std::vector<UserId> friends = getFriends(id);
+        std::vector<uint32_t> shards;
+        for (size_t i = 0; i < friends.size(); ++i) {
+            if (users[friends[i]].isRemote()) {
+                shards.push_back(shardOfUser(users[friends[i]].username, shardCount));
+            }
+        }
+        std::sort(shards.begin(), shards.end());
+        shards.erase(std::unique(shards.begin(), shards.end()), shards.end());
+        return shards;
+    }
+
+    // Mutations return once their journal record is queued; it reaches the disk with the next group
+    // commit. The future becomes true when every mutation that returned before this call is durable
+    // (false if the journal could not be written). commitNow skips the rest of the flush interval.
+    std::shared_future<bool> durableFuture(bool commitNow = false) {
+        return journal.durableFuture(commitNow);
+    }
+
+    // Waits until every mutation so far is durable
+    bool syncJournal() {
+        return durableFuture(true).get();
+    }
+
+    // Batches group many operations behind one persistence point: their journal records are
+    // buffered and only committed when the batch is (or when the buffer fills up).
+    void beginBatch() {
+        journal.hold(true);
+    }
+
+    bool commitBatch() {
+        journal.hold(false);
+        return syncJournal();
+    }
+
+    // --- User Management ---
+
+    // Allows a new user to register with a unique username, password, and bio
+    void registerUser() {
+        std::string username, password, bio;
+        std::cout << "Enter desired username: ";
+        std::cin >> username;
+        // Clear the input buffer after reading username to prevent issues with subsequent getline
+        std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+
+        if (userExists(username)) {
+            std::cout << "Username already taken. Please choose another.\n";
+            return;
+        }
+
+        std::cout << "Enter password: ";
+        std::cin >> password;
+        std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n'); // Clear buffer
+
+        std::cout << "Enter a short bio (e.g., 'Loves coding'): ";
+        std::getline(std::cin, bio); // Use getline for bio as it can contain spaces
+
+        OpStatus status = createUser(username, password, bio);
+        if (status == OP_OK) {
+            std::cout << "User " << username << " registered successfully!\n";
+        } else if (status == OP_USER_EXISTS) {
+            std::cout << "Username already taken. Please choose another.\n";
+        } else {
+            std::cout << "Usernames and passwords cannot contain '|'.\n";
+        }
+    }
+
+    // Allows an existing user to log in
+    bool loginUser() {
+        std::string username, password;
+        std::cout << "Enter username: ";
+        std::cin >> username;
+        std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n'); // Clear buffer
+
+        std::cout << "Enter password: ";
+        std::cin >> password;
+        std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n'); // Clear buffer
+
+        if (authenticate(username, password, loggedInUser) == OP_OK) {
+            std::cout << "Welcome, " << users[loggedInUser].username << "!\n";
+            return true;
+        } else {
+            std::cout << "Invalid username or password.\n";
+            return false;
+        }
+    }
+
+    // Logs out the current user
+    void logoutUser() {
+        loggedInUser = NO_USER;
+        std::cout << "Logged out successfully.\n";
+    }
+
+    // Checks if any user is currently logged in
+    bool isLoggedIn() const {
+        return loggedInUser != NO_USER;
+    }
+
+    // Returns the username of the currently logged-in user
+    std::string getLoggedInUser() const {
+        return isLoggedIn() ? users[loggedInUser].username : std::string();
+    }
+
+    // --- Friend Management ---
+
+    // Allows the logged-in user to add another user as a friend
+    void addFriend() {
+        if (!isLoggedIn()) {
+            std::cout << "Please log in to add friends.\n";
+            return;
+        }
+
+        std::string friendUsername;
+        std::cout << "Enter username of person to add as friend: ";
+        std::cin >> friendUsername;
+        std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n'); // Clear buffer
+
+        switch (befriend(loggedInUser, findUserId(friendUsername))) {
+        case OP_OK:
+            std::cout << "You are now friends with " << friendUsername << "!\n";
+            break;
+        case OP_SELF_FRIEND:
+            std::cout << "You cannot add yourself as a friend.\n";
+            break;
+        case OP_ALREADY_FRIENDS:
+            std::cout << "You are already friends with " << friendUsername << ".\n";
+            break;
+        default:
+            std::cout << "User " << friendUsername << " does not exist.\n";
+            break;
+        }
+    }
+
+    // Allows the logged-in user to remove a friend
+    void removeFriend() {
+        if (!isLoggedIn()) {
+            std::cout << "Please log in to remove friends.\n";
+            return;
+        }
+
+        std::string friendUsername;
+        std::cout << "Enter username of person to remove from friends: ";
+        std::cin >> friendUsername;
+        std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n'); // Clear buffer
+
+        if (friendships[loggedInUser].empty()) {
+            std::cout << "You have no friends to remove.\n";
+            return;
+        }
+
+        if (unfriend(loggedInUser, findUserId(friendUsername)) != OP_OK) {
+            std::cout << "You are not friends with " << friendUsername << ".\n";
+            return;
+        }
+        std::cout << "You have removed " << friendUsername << " from your friends.\n";
+    }
+
+    // Displays the list of friends for a given username
+    void viewFriends(const std::string& username) const {
+        UserId id = findUserId(username);
+        if (id == NO_USER) {
+            std::cout << "User " << username << " not found.\n";
+            return;
+        }
+
+        std::cout << "--------------------------------\n";
+        std::cout << username << "'s Friends:\n";
+        const std::vector<UserId>& friends = friendships[id];
+        if (!friends.empty()) {
+            for (size_t i = 0; i < friends.size(); ++i) { // Changed to index-based loop
+                std::cout << "- " << users[friends[i]].username << "\n";
+            }
+        } else {
+            std::cout << "(No friends yet)\n";
+        }
+        std::cout << "--------------------------------\n";
+    }
+
+    // Point-in-time CSR copy of the friendship graph for analytics. The copy is shared by all queries
+    // until the graph changes. It is taken one friend stripe at a time, each under its own lock (and
+    // tableLock shared), so friend, user and post changes only wait for one stripe's worth of copying.
+    // Like a seqlock, the copy is retried when graphVersion moved meanwhile. After
+    // GRAPH_SNAPSHOT_ATTEMPTS the last copy is used anyway: it may hold only one side of a
+    // friendship that changed during the copy, and stays marked stale so the next query rebuilds it.
+    // The analytics themselves then run without blocking anything.
+    // Call without holding a ReadGuard or friend locks (this takes them itself).
+    std::shared_ptr<const FriendGraph> friendGraph() const {
+        std::lock_guard<std::mutex> graphGuard(graphMutex);
+        if (graphSnapshot && graphSnapshotVersion == graphVersion) {
+            return graphSnapshot;
+        }
+        ScopedLatency timer(METRIC_GRAPH_SNAPSHOT);
+        // Per stripe: the friend counts of its users (in ID order) and their lists back to back
+        std::vector<std::vector<uint32_t> > stripeCounts(FRIEND_LOCK_STRIPES);
+        std::vector<std::vector<UserId> > stripeTargets(FRIEND_LOCK_STRIPES);
+        uint64_t version = 0;
+        size_t userCount = 0;
+        bool consistent = false;
+        for (int attempt = 0; attempt < GRAPH_SNAPSHOT_ATTEMPTS && !consistent; ++attempt) {
+            version = graphVersion;
+            {
+                SharedGuard tableGuard(tableLock);
+                userCount = friendships.size();
+            }
+            for (size_t stripe = 0; stripe < FRIEND_LOCK_STRIPES; ++stripe) {
+                SharedGuard tableGuard(tableLock);
+                SharedGuard stripeGuard(friendLocks[stripe]);
+                stripeCounts[stripe].clear();
+                stripeTargets[stripe].clear();
+                for (size_t user = stripe; user < userCount; user += FRIEND_LOCK_STRIPES) {
+                    const std::vector<UserId>& friends = friendships[user];
+                    uint32_t count = 0;
+                    for (size_t i = 0; i < friends.size(); ++i) {
+                        if (friends[i] < userCount) { // Users added during the copy are left out
+                            stripeTargets[stripe].push_back(friends[i]);
+                            ++count;
+                        }
+                    }
+                    stripeCounts[stripe].push_back(count);
+                }
+            }
+            consistent = graphVersion == version;
+        }
+
+        std::vector<uint64_t> offsets(userCount + 1, 0);
+        for (size_t user = 0; user < userCount; ++user) {
+            offsets[user + 1] = offsets[user] + stripeCounts[user % FRIEND_LOCK_STRIPES][user / FRIEND_LOCK_STRIPES];
+        }
+        std::vector<UserId> targets(offsets.back());
+        std::vector<size_t> stripePos(FRIEND_LOCK_STRIPES, 0);
+        for (size_t user = 0; user < userCount; ++user) {
+            size_t stripe = user % FRIEND_LOCK_STRIPES;
+            size_t count = static_cast<size_t>(offsets[user + 1] - offsets[user]);
+            if (count != 0) {
+                std::memcpy(&targets[offsets[user]], &stripeTargets[stripe][stripePos[stripe]], count * sizeof(UserId));
+            }
+            stripePos[stripe] += count;
+        }
+        graphSnapshot.reset(new FriendGraph(offsets, targets));
+        graphSnapshotVersion = version; // Behind graphVersion for good if the copy raced a change
+        return graphSnapshot;
+    }
+
+    // Friends that 'user' and 'other' have in common, in ID order
+    std::vector<UserId> mutualFriends(UserId user, UserId other) const {
+        ScopedLatency timer(METRIC_MUTUAL_FRIENDS);
+        std::vector<UserId> common;
+        intersectSorted(getFriends(user), getFriends(other), &common);
+        return common;
+    }
+
+    // "People you may know": up to 'limit' non-friends of 'user' ranked by mutual friends.
+    // Candidates are the friends of the user's friends. When visiting all of those edges would exceed
+    // SUGGESTION_EDGE_BUDGET (hubs, or friends of hubs), every stride-th edge is visited instead and
+    // the best SUGGESTION_RERANK_FACTOR * limit candidates by sampled count are kept. Either way, the
+    // final counts are exact intersections of the sorted friend lists.
+    std::vector<FriendSuggestion> suggestFriends(UserId user, size_t limit) const {
+        ScopedLatency timer(METRIC_SUGGEST_FRIENDS);
+        std::vector<FriendSuggestion> suggestions;
+        std::vector<UserId> friends = getFriends(user);
+        if (friends.empty() || limit == 0) {
+            return suggestions;
+        }
+        uint64_t edges = 0;
+        for (size_t i = 0; i < friends.size(); ++i) {
+            SharedGuard guard(friendLock(friends[i]));
+            edges += friendships[friends[i]].size();
+        }
+        uint64_t stride = std::max<uint64_t>(1, (edges + SUGGESTION_EDGE_BUDGET - 1) / SUGGESTION_EDGE_BUDGET);
+
+        // Collect (sampled) friends of friends
+        std::vector<UserId> candidates;
+        candidates.reserve(std::min<uint64_t>(edges, SUGGESTION_EDGE_BUDGET));
+        uint64_t position = (stride > 1) ? (static_cast<uint64_t>(user) * 2654435761u) % stride : 0; // Fixed offset per user
+        uint64_t seen = 0;
+        for (size_t i = 0; i < friends.size(); ++i) {
+            SharedGuard guard(friendLock(friends[i]));
+            const std::vector<UserId>& theirFriends = friendships[friends[i]];
+            for (; position < seen + theirFriends.size(); position += stride) {
+                candidates.push_back(theirFriends[position - seen]);
+            }
+            seen += theirFriends.size();
+        }
+
+        // Count by sorting: each run of one ID is one candidate. The user and existing friends are
+        // dropped here, once per distinct ID (both lists are sorted, so this is a merge).
+        std::sort(candidates.begin(), candidates.end());
+        std::vector<UserId>::const_iterator known = friends.begin();
+        for (size_t i = 0; i < candidates.size();) {
+            size_t j = i;
+            while (j < candidates.size() && candidates[j] == candidates[i]) {
+                ++j;
+            }
+            while (known != friends.end() && *known < candidates[i]) {
+                ++known;
+            }
+            if (candidates[i] != user && (known == friends.end() || *known != candidates[i])) {
+                FriendSuggestion suggestion = { candidates[i], static_cast<uint32_t>(j - i) };
+                suggestions.push_back(suggestion);
+            }
+            i = j;
+        }
+
+        if (stride > 1) {
+            // Sampled counts are estimates: re-rank the most promising candidates exactly
+            size_t keep = std::min(suggestions.size(), limit * SUGGESTION_RERANK_FACTOR);
+            std::partial_sort(suggestions.begin(), suggestions.begin() + keep, suggestions.end(), CompareSuggestions());
+            suggestions.resize(keep);
+            for (size_t i = 0; i < suggestions.size(); ++i) {
+                SharedGuard guard(friendLock(suggestions[i].user));
+                suggestions[i].mutualFriends = static_cast<uint32_t>(intersectSorted(friends, friendships[suggestions[i].user], NULL));
+            }
+        }
+        size_t count = std::min(suggestions.size(), limit);
+        std::partial_sort(suggestions.begin(), suggestions.begin() + count, suggestions.end(), CompareSuggestions());
+        suggestions.resize(count);
+        return suggestions;
+    }
+
+    // Shows the logged-in user the people they may know
+    void viewSuggestions() const {
+        if (!isLoggedIn()) {
+            std::cout << "Please log in to see friend suggestions.\n";
+            return;
+        }
+        std::vector<FriendSuggestion> suggestions = suggestFriends(loggedInUser, SUGGESTION_COUNT);
+        std::cout << "--------------------------------\n";
+        std::cout << "People You May Know:\n";
+        for (size_t i = 0; i < suggestions.size(); ++i) {
+            std::cout << "- " << users[suggestions[i].user].username << " (" << suggestions[i].mutualFriends
+                      << " mutual friend" << (suggestions[i].mutualFriends == 1 ? "" : "s") << ")\n";
+        }
+        if (suggestions.empty()) {
+            std::cout << "(No suggestions yet. Add some friends first!)\n";
+        }
+        std::cout << "--------------------------------\n";
+    }
+
+    // Shows the friends the logged-in user has in common with another user
+    void viewMutualFriends(const std::string& otherUsername) const {
+        if (!isLoggedIn()) {
+            std::cout << "Please log in to see mutual friends.\n";
+            return;
+        }
+        UserId other = findUserId(otherUsername);
+        if (other == NO_USER) {
+            std::cout << "User " << otherUsername << " not found.\n";
+            return;
+        }
+        std::vector<UserId> common = mutualFriends(loggedInUser, other);
+        std::cout << "--------------------------------\n";
+        std::cout << "Mutual friends with " << otherUsername << ":\n";
+        for (size_t i = 0; i < common.size(); ++i) {
+            std::cout << "- " << users[common[i]].username << "\n";
+        }
+        if (common.empty()) {
+            std::cout << "(No mutual friends)\n";
+        }
+        std::cout << "--------------------------------\n";
+    }
+
+    // --- Post Management ---
+
+    // Allows the logged-in user to create and post a new message
+    void postMessage() {
+        if (!isLoggedIn()) {
+            std::cout << "Please log in to post messages.\n";
+            return;
+        }
+
+        std::string content;
+        std::cout << "Enter your message (max 255 chars, no newlines): ";
+        std::getline(std::cin, content); // Use getline for message content to capture spaces
+
+        if (content.length() > MAX_POST_LENGTH) {
+            std::cout << "Message truncated to 255 characters.\n"; // createPost does the truncation
+        }
+
+        PostHandle handle;
+        createPost(loggedInUser, content, handle);
+        std::cout << "Message posted successfully!\n";
+    }
+
+    // Returns up to 'limit' of the author's posts older than 'before' (NO_POST for the newest), newest first.
+    // 'nextCursor' receives the cursor for the following page, or NO_POST when there are no older posts.
+    // Cost is O(log n + limit) in the author's own post count.
+    std::vector<PostHandle> profilePage(UserId author, size_t limit, PostHandle before, PostHandle& nextCursor) const {
+        ScopedLatency timer(METRIC_PROFILE_PAGE);
+        const std::vector<PostHandle>& authored = postsByAuthor[author];
+        std::vector<PostHandle>::const_iterator end = (before == NO_POST) ? authored.end()
+            : std::lower_bound(authored.begin(), authored.end(), before);
+        size_t available = static_cast<size_t>(end - authored.begin());
+        size_t count = std::min(limit, available);
+        std::vector<PostHandle> page;
+        page.reserve(count);
+        for (size_t i = 0; i < count; ++i) {
+            page.push_back(*(end - 1 - i));
+        }
+        nextCursor = (count > 0 && count < available) ? page.back() : NO_POST;
+        return page;
+    }
+
+    // Views the profile and posts of a specified user, one page at a time.
+    // Pass the returned cursor back as 'before' to show the next (older) page; NO_POST means no more posts.
+    PostHandle viewProfile(const std::string& username, size_t limit = PROFILE_PAGE_SIZE, PostHandle before = NO_POST) const {
+        UserId id = findUserId(username);
+        if (id == NO_USER) {
+            std::cout << "User " << username << " not found.\n";
+            return NO_POST;
+        }
+        if (before == NO_POST) {
+            users[id].displayProfile(text.str(users[id].bio)); // Display user's bio
+            std::cout << "Posts by " << username << ":\n";
+        }
+        PostHandle nextCursor = NO_POST;
+        std::vector<PostHandle> page = profilePage(id, limit, before, nextCursor);
+        for (size_t i = 0; i < page.size(); ++i) {
+            posts[page[i]].displayPost(username, text.str(posts[page[i]].content)); // Display each post by this user
+        }
+        if (page.empty() && before == NO_POST) {
+            std::cout << "(No posts yet)\n";
+        }
+        return nextCursor;
+    }
+
+    // Returns up to 'limit' posts older than 'before' (NO_POST for the newest) from the user and their
+    // friends, newest first. A cached feed (see FeedCache) answers in O(limit). Otherwise each author's
+    // post list is already in posting order, so this is a k-way merge over those lists with a heap,
+    // stopping after 'limit' posts: O(k log d + limit log k) for k authors, independent of the total
+    // number of posts; the first page of such a merge is cached. 'nextCursor' receives the cursor for
+    // the following page, or NO_POST when the feed is exhausted.
+    std::vector<PostHandle> feedPage(UserId user, size_t limit, PostHandle before, PostHandle& nextCursor) const {
+        ScopedLatency timer(METRIC_FEED_PAGE);
+        std::vector<PostHandle> page;
+        if (feedCache.read(user, limit, before, postsByAuthor, page, nextCursor)) {
+            instrumentation.add(COUNTER_FEED_CACHE_HITS);
+            return page;
+        }
+        if (!feedCache.enabled() || before != NO_POST) {
+            return mergeFeed(user, getFriends(user), limit, before, nextCursor); // Older pages are not cached
+        }
+
+        instrumentation.add(COUNTER_FEED_CACHE_MISSES);
+        uint64_t generation = feedCache.generation(user); // Before the friend list is read
+        const std::vector<UserId> friends = getFriends(user);
+        PostHandle more = NO_POST;
+        std::vector<PostHandle> start = mergeFeed(user, friends, std::max(limit, FEED_CACHE_POSTS), NO_POST, more);
+        std::vector<UserId> pulled;
+        for (size_t i = 0; i <= friends.size(); ++i) {
+            UserId author = i < friends.size() ? friends[i] : user;
+            if (pulledAuthors[author]) {
+                pulled.push_back(author);
+            }
+        }
+        bool complete = more == NO_POST && start.size() <= FEED_CACHE_POSTS;
+        feedCache.store(user, generation,
+                        std::vector<PostHandle>(start.begin(), start.begin() + std::min(start.size(), FEED_CACHE_POSTS)),
+                        complete, static_cast<PostHandle>(posts.size()), pulled);
+
+        page.assign(start.begin(), start.begin() + std::min(start.size(), limit));
+        nextCursor = (!page.empty() && (start.size() > limit || more != NO_POST)) ? page.back() : NO_POST;
+        return page;
+    }
+
+    // Returns up to 'limit' posts older than 'before' (NO_POST for the newest) that match 'query',
+    // newest first. With 'scopeUser' set, only posts by that user and their friends count.
+    // The rarest term's posting list drives a descending intersection: every other list seeks to the
+    // candidate through its skip table, so long lists are mostly skipped rather than decoded.
+    // 'nextCursor' receives the cursor for the following page, or NO_POST when there are no more matches.
+    std::vector<PostHandle> searchPage(const SearchQuery& query, UserId scopeUser, size_t limit, PostHandle before,
+                                       PostHandle& nextCursor) const {
+        ScopedLatency timer(METRIC_SEARCH);
+        std::vector<PostHandle> page;
+        nextCursor = NO_POST;
+        if (query.terms.empty() || limit == 0 || before == 0) {
+            return page;
+        }
+        std::vector<const PostingList*> lists;
+        for (size_t i = 0; i < query.terms.size(); ++i) {
+            const PostingList* list = searchIndex.find(query.terms[i]);
+            if (list == NULL) {
+                return page; // No post has this term
+            }
+            lists.push_back(list);
+        }
+        std::sort(lists.begin(), lists.end(), CompareListSizes());
+        std::vector<PostingCursor> cursors;
+        for (size_t i = 0; i < lists.size(); ++i) {
+            cursors.push_back(PostingCursor(lists[i]));
+        }
+        std::vector<UserId> scope;
+        if (scopeUser != NO_USER) {
+            scope = getFriends(scopeUser);
+            scope.insert(std::lower_bound(scope.begin(), scope.end(), scopeUser), scopeUser); // Own posts too
+        }
+
+        PostHandle target = (before == NO_POST) ? NO_POST : before - 1;
+        while (true) {
+            cursors[0].seekAtMost(target);
+            if (cursors[0].atEnd()) {
+                break;
+            }
+            PostHandle candidate = cursors[0].current();
+            bool exhausted = false;
+            bool inAll = true;
+            for (size_t i = 1; i < cursors.size(); ++i) {
+                cursors[i].seekAtMost(candidate);
+                if (cursors[i].atEnd()) {
+                    exhausted = true;
+                    break;
+                }
+                if (cursors[i].current() != candidate) {
+                    target = cursors[i].current(); // Nothing between it and the candidate can match
+                    inAll = false;
+                    break;
+                }
+            }
+            if (exhausted) {
+                break;
+            }
+            if (!inAll) {
+                continue;
+            }
+            const Post& post = posts[candidate];
+            if ((scope.empty() || std::binary_search(scope.begin(), scope.end(), post.author))
+                && query.matchesPhrases(text.data(post.content), post.content.length)) {
+                if (page.size() == limit) {
+                    nextCursor = page.empty() ? NO_POST : page.back(); // There is at least one more match
+                    break;
+                }
+                page.push_back(candidate);
+            }
+            if (candidate == 0) {
+                break;
+            }
+            target = candidate - 1;
+        }
+        return page;
+    }
+
+    // The most active posters and most frequent terms of the trending window 'window' ("5m", "1h"
+    // or "1d"). Answered from the streaming counters in O(TRENDING_CANDIDATES), whatever the number of
+    // posts. Returns false for an unknown window.
+    bool trendingReport(const std::string& window, size_t limit, TrendingReport& report) const {
+        ScopedLatency timer(METRIC_TRENDING);
+        return trending.report(window, limit, report);
+    }
+
+    // Shows what is trending in one window
+    void viewTrending(const std::string& window) const {
+        TrendingReport report;
+        if (!trendingReport(window, TRENDING_COUNT, report)) {
+            std::cout << "Unknown time window " << window << ".\n";
+            return;
+        }
+        std::cout << "--------------------------------\n";
+        std::cout << "Trending in the last " << window << " (" << report.posts << " post" << (report.posts == 1 ? "" : "s") << "):\n";
+        std::cout << "Most active posters:\n";
+        for (size_t i = 0; i < report.posters.size(); ++i) {
+            std::cout << "- " << users[report.posters[i].first].username << " (" << report.posters[i].second << ")\n";
+        }
+        std::cout << "Most used words:\n";
+        for (size_t i = 0; i < report.terms.size(); ++i) {
+            std::cout << "- " << report.terms[i].first << " (" << report.terms[i].second << ")\n";
+        }
+        if (report.posts == 0) {
+            std::cout << "(Nothing posted yet)\n";
+        }
+        std::cout << "--------------------------------\n";
+    }
+
+    // Displays one page of posts matching 'query', from everyone or only from the logged-in user
+    // and their friends. Returns the cursor for the next (older) page, or NO_POST.
+    PostHandle viewSearch(const std::string& query, bool friendsOnly, size_t limit = FEED_PAGE_SIZE, PostHandle before = NO_POST) const {
+        PostHandle nextCursor = NO_POST;
+        std::vector<PostHandle> page = searchPage(SearchQuery(query), friendsOnly ? loggedInUser : NO_USER, limit, before, nextCursor);
+        if (page.empty() && before == NO_POST) {
+            std::cout << "No posts match \"" << query << "\".\n";
+        }
+        for (size_t i = 0; i < page.size(); ++i) {
+            const Post& post = posts[page[i]];
+            post.displayPost(users[post.author].username, text.str(post.content));
+        }
+        return nextCursor;
+    }
+
+    // Displays one page of the social feed for the logged-in user (their posts and their friends' posts).
+    // Pass the returned cursor back as 'before' to show the next (older) page; NO_POST means no more posts.
+    PostHandle viewFeed(size_t limit = FEED_PAGE_SIZE, PostHandle before = NO_POST) const {
+        if (!isLoggedIn()) {
+            std::cout << "Please log in to view your feed.\n";
+            return NO_POST;
+        }
+
+        if (before == NO_POST) {
+            std::cout << "--------------------------------\n";
+            std::cout << "Your Social Feed:\n";
+            std::cout << "--------------------------------\n";
+        }
+
+        PostHandle nextCursor = NO_POST;
+        std::vector<PostHandle> page = feedPage(loggedInUser, limit, before, nextCursor);
+        if (page.empty() && before == NO_POST) {
+            std::cout << "No posts in your feed yet. Add friends or post something!\n";
+        } else {
+            for (size_t i = 0; i < page.size(); ++i) { // Changed to index-based loop
+                const Post& post = posts[page[i]]; // Display straight from the post table, no copies
+                post.displayPost(users[post.author].username, text.str(post.content));
+            }
+        }
+        if (nextCursor == NO_POST) {
+            std::cout << "--------------------------------\n";
+        }
+        return nextCursor;
+    }
+};
+
+// --- Batch Mode ---
+//
+// Reads one command per line and prints tab-separated results, e.g.
+//   register <user> <password> [bio...]     ->  ok  register  <user>
+//   friend <user> <friend>                  ->  ok  friend  <user>  <friend>
+//   unfriend <user> <friend>
+//   post <user> <content...>                ->  ok  post  <post id>
+//   feed <user> [limit] [cursor]            ->  post  <post id>  <author>  <timestamp>  <content>  (per post)
+//   profile <user> [limit] [cursor]             ok  feed  <count>  <next cursor or ->
+//                                               (a cursor is a post ID; the page holds older posts)
+//   friends <user>                          ->  friend  <name>  (per friend), then ok  friends  <count>
+//   mutual <user> <other>                   ->  friend  <name>  (per common friend), then ok  mutual  <count>
+//   suggest <user> [limit]                  ->  suggestion  <name>  <mutual friends>  (best first),
+//                                               then ok  suggest  <count>
+//   hops <user> <other>                     ->  hop  <name>  (per user on a shortest path), then
+//                                               ok  hops  <degrees of separation, or - if unconnected>
+//   community <user>                        ->  ok  community  <users in the user's connected component>
+//   components                              ->  ok  components  <count>  <largest>  <users>  <friendships>
+//   search <all|user> <limit|-> <cursor|-> <query...>   ->  like feed; words are ANDed, "quoted words"
+//                                               form a phrase; <user> limits it to the user and friends
+//   trending <5m|1h|1d> [limit]             ->  poster  <name>  <posts>  (most active first),
+//                                               term  <term>  <posts using it>  (most frequent first),
+//                                               then ok  trending  <window>  <posts in the window>
+//   save                                    ->  writes a snapshot now (batch mode only)
+//   link|unlink <user> <remote user>        ->  ok  link  <user>  <remote user>: this shard's half of a
+//                                               friendship with a user of another shard (router only);
+//                                               the pair stays pending until settled
+//   settle <user> <remote user>             ->  ok  settle  <user>  <remote user>: both halves match (router only)
+//   pending [user]                          ->  pending  <user>  <remote user>  <linked|unlinked>  (per
+//                                               unsettled pair), then ok  pending  <count>  (router only)
+//   shards <user>                           ->  ok  shards  <shard>...: other shards owning the user's
+//                                               friends (router only)
+//   sync                                    ->  ok  sync  once every mutation so far is durable on disk
+//   login <user> <password> / logout        ->  server mode: the connection then acts as <user>
+//   stats [on|off]                          ->  latency  <op>  <count>  <p50>  <p99>  <max>  (microseconds),
+//                                               counter  <name>  <value>,  memory  <table>  <bytes>,
+//                                               tier  <hot|cold>  <posts>,
+//                                               then ok  stats  <sampling or not_sampling>
+//                                               (on|off switches sampling; batch mode only)
+// Failures print "error <command> <status>". Blank lines and lines starting with '#' are ignored.
+// All mutations of a batch are persisted together when the batch ends. In server mode mutations are
+// acknowledged before they reach the disk (they are group-committed within the flush interval);
+// a client that needs durability sends sync.
+
+// Splits the next space-separated word off the front of 'rest'
+std::string nextWord(std::string& rest) {
+    size_t begin = rest.find_first_not_of(" \t");
+    if (begin == std::string::npos) {
+        rest.clear();
+        return std::string();
+    }
+    size_t end = rest.find_first_of(" \t", begin);
+    std::string word = rest.substr(begin, end == std::string::npos ? std::string::npos : end - begin);
+    rest = (end == std::string::npos) ? std::string() : rest.substr(end + 1);
+    return word;
+}
+
+// Writes a free-text field with its tabs replaced, so it cannot break the tab-separated output
+void writeTabSafe(std::ostream& out, const char* data, size_t length) {
+    const char* end = data + length;
+    while (data < end) {
+        const char* tab = static_cast<const char*>(std::memchr(data, '\t', end - data));
+        if (tab == NULL) {
+            out.write(data, end - data);
+            break;
+        }
+        out.write(data, tab - data);
+        out.put(' ');
+        data = tab + 1;
+    }
+}
+
+// Parses an optional page size / cursor argument; "-" or nothing keeps the default
+bool parseNumberArg(const std::string& word, uint32_t& value) {
+    if (word.empty() || word == "-") {
+        return true;
+    }
+    if (word.find_first_not_of("0123456789") != std::string::npos || word.size() > 9) {
+        return false;
+    }
+    value = static_cast<uint32_t>(std::strtoul(word.c_str(), NULL, 10));
+    return true;
+}
+
+// Parses "<index>/<count>" naming one shard of a sharded network
+bool parseShardArg(const std::string& word, uint32_t& index, uint32_t& count) {
+    std::string::size_type slash = word.find('/');
+    uint32_t shardIndex = 0;
+    uint32_t shardCount = 0;
+    if (slash == std::string::npos || slash == 0 || slash + 1 == word.size()
+        || !parseNumberArg(word.substr(0, slash), shardIndex) || !parseNumberArg(word.substr(slash + 1), shardCount)
+        || shardCount > (1u << POST_ID_SHARD_BITS) || shardIndex >= shardCount) {
+        return false; // Post IDs have room for 2^POST_ID_SHARD_BITS shards
+    }
+    index = shardIndex;
+    count = shardCount;
+    return true;
+}
+
+// Parses an optional post cursor: a post ID (bare or "post_<id>"); "-" or nothing keeps NO_POST.
+// Callers hold a ReadGuard.
+bool parseCursorArg(const SocialNetwork& app, const std::string& word, PostHandle& cursor) {
+    if (word.empty() || word == "-") {
+        return true;
+    }
+    uint64_t id = parsePostId(word);
+    if (id == 0) {
+        return false;
+    }
+    cursor = app.postCursor(id);
+    return true;
+}
+
+// Prints one page of posts followed by its summary line. Posts and cursors are shown by post ID.
+void printPostPage(const SocialNetwork& app, const std::string& command, const std::vector<PostHandle>& page,
+                   PostHandle nextCursor, std::ostream& out) {
+    for (size_t i = 0; i < page.size(); ++i) {
+        const Post& post = app.getPost(page[i]);
+        out << "post\t" << post.postId << "\t" << app.getUser(post.author).username << "\t" << post.timestamp << "\t";
+        writeTabSafe(out, app.getText(post.content), post.content.length); // Straight from the arena
+        out << "\n";
+    }
+    out << "ok\t" << command << "\t" << page.size() << "\t";
+    if (nextCursor == NO_POST) {
+        out << "-";
+    } else {
+        out << app.getPost(nextCursor).postId;
+    }
+    out << "\n";
+}
+
+// Prints the latency percentiles (microseconds), counters and memory use of the network
+void printStats(const SocialNetwork& app, std::ostream& out) {
+    for (int i = 0; i < METRIC_COUNT; ++i) {
+        const LatencyHistogram& histogram = instrumentation.latency(static_cast<Metric>(i));
+        out << "latency\t" << metricName(static_cast<Metric>(i)) << "\t" << histogram.count() << "\t"
+            << histogram.percentile(0.5) / 1000.0 << "\t" << histogram.percentile(0.99) / 1000.0 << "\t"
+            << histogram.max() / 1000.0 << "\n";
+    }
+    for (int i = 0; i < COUNTER_COUNT; ++i) {
+        out << "counter\t" << counterName(static_cast<Counter>(i)) << "\t" << instrumentation.get(static_cast<Counter>(i)) << "\n";
+    }
+    std::vector<MemoryUsage> memory;
+    size_t hotPosts = 0;
+    size_t coldPosts = 0;
+    {
+        SocialNetwork::ReadGuard guard(app);
+        memory = app.memoryUsage();
+        app.tierSizes(hotPosts, coldPosts);
+    }
+    for (size_t i = 0; i < memory.size(); ++i) {
+        out << "memory\t" << memory[i].structure << "\t" << memory[i].bytes << "\n";
+    }
+    out << "tier\thot\t" << hotPosts << "\ntier\tcold\t" << coldPosts << "\n";
+    out << "ok\tstats\t" << (instrumentation.samplingEnabled() ? "sampling" : "not_sampling") << "\n";
+}
+
+// Who is issuing commands. Batch scripts are trusted and may act as any user; server clients
+// must log in first and can only act as themselves.
+struct Session {
+    UserId user;  // Logged-in user, or NO_USER
+    std::string name; // Name of the logged-in user where IDs are per shard (router sessions)
+    bool trusted;
+
+    explicit Session(bool trusted = false) : user(NO_USER), trusted(trusted) {}
+
+    // Whether this session may act on behalf of 'actor'
+    bool mayActAs(UserId actor) const {
+        return trusted || (user != NO_USER && user == actor);
+    }
+};
+
+// Resolves a username under a short read lock
+UserId lookupUser(const SocialNetwork& app, const std::string& username) {
+    SocialNetwork::ReadGuard guard(app);
+    return app.findUserId(username);
+}
+
+// Checks that the session may act as 'actor' (which must exist)
+OpStatus checkActor(const Session& session, UserId actor) {
+    if (!session.trusted && session.user == NO_USER) {
+        return OP_NOT_LOGGED_IN;
+    }
+    if (actor == NO_USER) {
+        return OP_NO_SUCH_USER;
+    }
+    return session.mayActAs(actor) ? OP_OK : OP_FORBIDDEN;
+}
+
+// Runs one command line for 'session' and prints its result. Returns false if the command failed.
+bool runCommand(SocialNetwork& app, Session& session, const std::string& line, std::ostream& out) {
+    std::string rest = line;
+    std::string command = nextWord(rest);
+    OpStatus status = OP_OK;
+
+    if (command == "register") {
+        std::string username = nextWord(rest);
+        std::string password = nextWord(rest);
+        status = app.createUser(username, password, rest);
+        if (status == OP_OK) {
+            out << "ok\tregister\t" << username << "\n";
+        }
+    } else if (command == "login") {
+        std::string username = nextWord(rest);
+        std::string password = nextWord(rest);
+        UserId user = NO_USER;
+        status = app.authenticate(username, password, user);
+        if (status == OP_OK) {
+            session.user = user;
+            out << "ok\tlogin\t" << username << "\n";
+        }
+    } else if (command == "logout") {
+        session.user = NO_USER;
+        out << "ok\tlogout\n";
+    } else if (command == "friend" || command == "unfriend") {
+        std::string username = nextWord(rest);
+        std::string friendName = nextWord(rest);
+        UserId user = lookupUser(app, username);
+        UserId friendId = lookupUser(app, friendName);
+        status = checkActor(session, user);
+        if (status == OP_OK) {
+            status = (command == "friend") ? app.befriend(user, friendId) : app.unfriend(user, friendId);
+        }
+        if (status == OP_OK) {
+            out << "ok\t" << command << "\t" << username << "\t" << friendName << "\n";
+        }
+    } else if (command == "post") {
+        UserId author = lookupUser(app, nextWord(rest));
+        PostHandle handle = NO_POST;
+        status = checkActor(session, author);
+        if (status == OP_OK) {
+            status = app.createPost(author, rest, handle);
+        }
+        if (status == OP_OK) {
+            SocialNetwork::ReadGuard guard(app); // The post table may be growing
+            out << "ok\tpost\t" << app.getPost(handle).postId << "\n";
+        }
+    } else if (command == "feed" || command == "profile") {
+        SocialNetwork::ReadGuard guard(app); // Posts must not be added while the page is printed
+        UserId user = app.findUserId(nextWord(rest));
+        uint32_t limit = static_cast<uint32_t>(command == "feed" ? FEED_PAGE_SIZE : PROFILE_PAGE_SIZE);
+        PostHandle cursor = NO_POST;
+        if (!parseNumberArg(nextWord(rest), limit) || !parseCursorArg(app, nextWord(rest), cursor)) {
+            status = OP_INVALID_ARGUMENT;
+        } else if (command == "feed") {
+            status = checkActor(session, user); // A feed is private; profiles are public
+        } else if (user == NO_USER) {
+            status = OP_NO_SUCH_USER;
+        }
+        if (status == OP_OK) {
+            PostHandle nextCursor = NO_POST;
+            std::vector<PostHandle> page = (command == "feed") ? app.feedPage(user, limit, cursor, nextCursor)
+                                                               : app.profilePage(user, limit, cursor, nextCursor);
+            printPostPage(app, command, page, nextCursor, out);
+        }
+    } else if (command == "search") {
+        SocialNetwork::ReadGuard guard(app);
+        std::string scopeName = nextWord(rest);
+        UserId scopeUser = (scopeName == "all") ? NO_USER : app.findUserId(scopeName);
+        uint32_t limit = static_cast<uint32_t>(FEED_PAGE_SIZE);
+        PostHandle cursor = NO_POST;
+        if (!parseNumberArg(nextWord(rest), limit) || !parseCursorArg(app, nextWord(rest), cursor)) {
+            status = OP_INVALID_ARGUMENT;
+        } else if (scopeName != "all") {
+            status = checkActor(session, scopeUser); // Friend-scoped search is as private as the feed
+        }
+        if (status == OP_OK) {
+            PostHandle nextCursor = NO_POST;
+            std::vector<PostHandle> page = app.searchPage(SearchQuery(rest), scopeUser, limit, cursor, nextCursor);
+            printPostPage(app, command, page, nextCursor, out);
+        }
+    } else if (command == "trending") {
+        SocialNetwork::ReadGuard guard(app); // Names of users added meanwhile
+        std::string window = nextWord(rest);
+        uint32_t limit = static_cast<uint32_t>(TRENDING_COUNT);
+        TrendingReport report;
+        if (!parseNumberArg(nextWord(rest), limit) || !app.trendingReport(window, limit, report)) {
+            status = OP_INVALID_ARGUMENT;
+        } else {
+            for (size_t i = 0; i < report.posters.size(); ++i) {
+                out << "poster\t" << app.getUser(report.posters[i].first).username << "\t" << report.posters[i].second << "\n";
+            }
+            for (size_t i = 0; i < report.terms.size(); ++i) {
+                out << "term\t" << report.terms[i].first << "\t" << report.terms[i].second << "\n";
+            }
+            out << "ok\ttrending\t" << window << "\t" << report.posts << "\n";
+        }
+    } else if (command == "mutual") {
+        SocialNetwork::ReadGuard guard(app);
+        UserId user = app.findUserId(nextWord(rest));
+        UserId other = app.findUserId(nextWord(rest));
+        if (user == NO_USER || other == NO_USER) {
+            status = OP_NO_SUCH_USER;
+        } else {
+            std::vector<UserId> common = app.mutualFriends(user, other);
+            for (size_t i = 0; i < common.size(); ++i) {
+                out << "friend\t" << app.getUser(common[i]).username << "\n";
+            }
+            out << "ok\tmutual\t" << common.size() << "\n";
+        }
+    } else if (command == "suggest") {
+        SocialNetwork::ReadGuard guard(app);
+        UserId user = app.findUserId(nextWord(rest));
+        uint32_t limit = static_cast<uint32_t>(SUGGESTION_COUNT);
+        if (!parseNumberArg(nextWord(rest), limit)) {
+            status = OP_INVALID_ARGUMENT;
+        } else {
+            status = checkActor(session, user);
+        }
+        if (status == OP_OK) {
+            std::vector<FriendSuggestion> suggestions = app.suggestFriends(user, limit);
+            for (size_t i = 0; i < suggestions.size(); ++i) {
+                out << "suggestion\t" << app.getUser(suggestions[i].user).username << "\t" << suggestions[i].mutualFriends << "\n";
+            }
+            out << "ok\tsuggest\t" << suggestions.size() << "\n";
+        }
+    } else if (command == "hops" || command == "community") {
+        UserId user = lookupUser(app, nextWord(rest));
+        UserId other = (command == "hops") ? lookupUser(app, nextWord(rest)) : user;
+        if (user == NO_USER || other == NO_USER) {
+            status = OP_NO_SUCH_USER;
+        } else if (command == "hops") {
+            std::shared_ptr<const FriendGraph> graph = app.friendGraph();
+            std::vector<UserId> path;
+            int hops;
+            {
+                ScopedLatency timer(METRIC_SHORTEST_PATH);
+                hops = graph->shortestPath(user, other, path);
+            }
+            SocialNetwork::ReadGuard guard(app);
+            for (size_t i = 0; i < path.size(); ++i) {
+                out << "hop\t" << app.getUser(path[i]).username << "\n";
+            }
+            out << "ok\thops\t";
+            if (hops < 0) {
+                out << "-";
+            } else {
+                out << hops;
+            }
+            out << "\n";
+        } else {
+            std::shared_ptr<const FriendGraph> graph = app.friendGraph();
+            ScopedLatency timer(METRIC_COMPONENTS);
+            out << "ok\tcommunity\t" << graph->componentSize(user) << "\n";
+        }
+    } else if (command == "components") {
+        std::shared_ptr<const FriendGraph> graph = app.friendGraph();
+        ScopedLatency timer(METRIC_COMPONENTS);
+        out << "ok\tcomponents\t" << graph->components() << "\t" << graph->largestComponentSize() << "\t"
+            << graph->userCount() << "\t" << graph->friendshipCount() << "\n";
+    } else if (command == "friends") {
+        SocialNetwork::ReadGuard guard(app);
+        UserId user = app.findUserId(nextWord(rest));
+        if (user == NO_USER) {
+            status = OP_NO_SUCH_USER;
+        } else {
+            std::vector<UserId> friends = app.getFriends(user);
+            for (size_t i = 0; i < friends.size(); ++i) {
+                out << "friend\t" << app.getUser(friends[i]).username << "\n";
+            }
+            out << "ok\tfriends\t" << friends.size() << "\n";
+        }
+    } else if (command == "stats") {
+        std::string mode = nextWord(rest);
+        if ((mode == "on" || mode == "off") && !session.trusted) {
+            status = OP_FORBIDDEN; // Sampling is process-wide; server clients may only read it
+        } else if (mode == "on" || mode == "off") {
+            instrumentation.setSampling(mode == "on");
+        } else if (!mode.empty()) {
+            status = OP_INVALID_ARGUMENT;
+        }
+        if (status == OP_OK) {
+            printStats(app, out);
+        }
+    } else if (command == "sync") {
+        if (!app.syncJournal()) {
+            status = OP_IO_ERROR;
+        } else {
+            out << "ok\tsync\n";
+        }
+    } else if (command == "save") {
+        if (!session.trusted) {
+            status = OP_FORBIDDEN;
+        } else {
+            app.saveData();
+            out << "ok\tsave\n";
+        }
+    } else if (command == "link" || command == "unlink") {
+        std::string username = nextWord(rest);
+        std::string remoteName = nextWord(rest);
+        UserId user = lookupUser(app, username);
+        if (!session.trusted) {
+            status = OP_FORBIDDEN;
+        } else if (user == NO_USER) {
+            status = OP_NO_SUCH_USER;
+        } else {
+            status = app.changeRemoteFriendship(user, remoteName, command == "link");
+        }
+        if (status == OP_OK) {
+            out << "ok\t" << command << "\t" << username << "\t" << remoteName << "\n";
+        }
+    } else if (command == "settle") {
+        std::string username = nextWord(rest);
+        std::string remoteName = nextWord(rest);
+        UserId user = lookupUser(app, username);
+        if (!session.trusted) {
+            status = OP_FORBIDDEN;
+        } else if (user == NO_USER) {
+            status = OP_NO_SUCH_USER;
+        } else {
+            status = app.settleRemoteFriendship(user, remoteName);
+        }
+        if (status == OP_OK) {
+            out << "ok\tsettle\t" << username << "\t" << remoteName << "\n";
+        }
+    } else if (command == "pending") {
+        SocialNetwork::ReadGuard guard(app);
+        std::string username = nextWord(rest);
+        UserId user = username.empty() ? NO_USER : app.findUserId(username);
+        if (!session.trusted) {
+            status = OP_FORBIDDEN;
+        } else if (!username.empty() && user == NO_USER) {
+            status = OP_NO_SUCH_USER;
+        } else {
+            std::vector<SocialNetwork::PendingLink> pending = app.pendingRemoteFriendships(user);
+            for (size_t i = 0; i < pending.size(); ++i) {
+                out << "pending\t" << app.getUser(pending[i].user).username << "\t" << app.getUser(pending[i].remote).username
+                    << "\t" << (pending[i].linked ? "linked" : "unlinked") << "\n";
+            }
+            out << "ok\tpending\t" << pending.size() << "\n";
+        }
+    } else if (command == "shards") {
+        SocialNetwork::ReadGuard guard(app);
+        UserId user = app.findUserId(nextWord(rest));
+        if (!session.trusted) {
+            status = OP_FORBIDDEN;
+        } else if (user == NO_USER) {
+            status = OP_NO_SUCH_USER;
+        } else {
+            std::vector<uint32_t> shards = app.friendShards(user);
+            out << "ok\tshards";
+            for (size_t i = 0; i < shards.size(); ++i) {
+                out << "\t" << shards[i];
+            }
+            out << "\n";
+        }
+    } else {
+        out << "error\t" << command << "\tunknown_command\n";
+        return false;
+    }
+
+    if (status != OP_OK) {
+        out << "error\t" << command << "\t" << opStatusName(status) << "\n";
+        return false;
+    }
+    return true;
+}
+
+// Runs every command from 'in' as one batch. Returns the process exit code (1 if any command failed).
+int runBatch(SocialNetwork& app, std::istream& in, std::ostream& out) {
+    size_t commands = 0;
+    size_t failures = 0;
+    std::string line;
+    Session session(true);
+    app.beginBatch();
+    while (std::getline(in, line)) {
+        if (!line.empty() && line[line.size() - 1] == '\r') {
+            line.erase(line.size() - 1); // Accept scripts with Windows line endings
+        }
+        if (line.find_first_not_of(" \t") == std::string::npos || line[line.find_first_not_of(" \t")] == '#') {
+            continue;
+        }
+        ++commands;
+        if (!runCommand(app, session, line, out)) {
+            ++failures;
+        }
+    }
+    bool durable = app.commitBatch(); // The single persistence point of the batch
+    std::cerr << "Batch finished: " << commands << " commands, " << failures << " failed.\n";
+    return failures == 0 && durable ? 0 : 1;
+}
+
+#ifdef __linux__
+// --- Server Mode ---
+//
+// Serves the batch command protocol to many concurrent clients over TCP on 127.0.0.1 or a Unix
+// socket. One epoll thread does all accepting and reading; complete lines are handed to a pool of
+// workers. A connection is processed by at most one worker at a time, so its responses come back
+// in order, while different connections run in parallel under SocialNetwork's own locking.
+// The commands are run by a functor, so the same server fronts a SocialNetwork (NetworkCommands)
+// or the shard router (ShardRouter).
+
+const size_t MAX_REQUEST_LINE = 64 * 1024;         // Longer lines close the connection
+const size_t MAX_OUTPUT_BACKLOG = 1024 * 1024;     // Stop reading from clients that do not read their replies
+
+volatile sig_atomic_t serverStopRequested = 0;
+int serverWakeFd = -1;
+
+// SIGINT/SIGTERM: wake the event loop so it can shut down cleanly
+void handleServerSignal(int) {
+    serverStopRequested = 1;
+    uint64_t one = 1;
+    ssize_t ignored = write(serverWakeFd, &one, sizeof(one));
+    (void)ignored;
+}
+
+// One client connection
+struct Connection {
+    int fd;
+    Session session;          // Only touched by the worker currently processing the connection
+    std::string inBuffer;     // Partial request line; only touched by the event loop
+    bool hungUp;              // Removed from epoll after a hang-up; only touched by the event loop
+
+    std::mutex mutex;         // Guards everything below
+    std::deque<std::string> pendingLines;
+    std::string outBuffer;    // Replies not yet accepted by the socket
+    bool busy;                // Queued for or running on a worker
+    bool inputClosed;         // The peer will send nothing more
+    bool closing;             // Drop the connection once the replies are flushed
+
+    Connection(int fd, bool trusted)
+        : fd(fd), session(trusted), hungUp(false), busy(false), inputClosed(false), closing(false) {}
+    ~Connection() { close(fd); } // Only once neither the event loop nor a worker refers to it
+
+    // Sends as much of outBuffer as the socket takes without blocking. Caller holds mutex.
+    void flush() {
+        while (!outBuffer.empty()) {
+            ssize_t sent = send(fd, outBuffer.data(), outBuffer.size(), MSG_NOSIGNAL);
+            if (sent < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                    outBuffer.clear(); // The peer is gone
+                    closing = true;
+                }
+                return;
+            }
+            outBuffer.erase(0, static_cast<size_t>(sent));
+        }
+    }
+
+    // Whether the connection has nothing left to do. Caller holds mutex.
+    bool finished() const {
+        return (closing || inputClosed) && !busy && outBuffer.empty();
+    }
+};
+
+// Runs server commands against a SocialNetwork in this process
+struct NetworkCommands {
+    SocialNetwork& app;
+
+    void operator()(Session& session, const std::string& line, std::ostream& out) const {
+        runCommand(app, session, line, out);
+    }
+};
+
+template <typename Commands>
+class Server {
+private:
+    Commands& commands;
+    bool trustClients; // Shard servers: every client is the router and may act as any user
+    int listenFd;
+    int epollFd;
+    std::string unixPath;  // Removed again on shutdown
+    std::map<int, std::shared_ptr<Connection> > connections; // Only touched by the event loop
+
+    std::vector<std::thread> workers;
+    std::mutex queueMutex;
+    std::condition_variable queueReady;
+    std::deque<std::shared_ptr<Connection> > queue;
+    bool stopping;
+
+    std::mutex dirtyMutex;
+    std::vector<int> dirtyFds; // Connections whose epoll interest may have to change
+
+    Server(const Server&);
+    Server& operator=(const Server&);
+
+    // Asks the event loop to look at a connection again
+    void markDirty(int fd) {
+        {
+            std::lock_guard<std::mutex> guard(dirtyMutex);
+            dirtyFds.push_back(fd);
+        }
+        uint64_t one = 1;
+        ssize_t ignored = write(serverWakeFd, &one, sizeof(one));
+        (void)ignored;
+    }
+
+    void enqueue(const std::shared_ptr<Connection>& conn) {
+        std::lock_guard<std::mutex> guard(queueMutex);
+        queue.push_back(conn);
+        queueReady.notify_one();
+    }
+
+    // Body of the worker threads
+    void runWorker() {
+        while (true) {
+            std::shared_ptr<Connection> conn;
+            {
+                std::unique_lock<std::mutex> lock(queueMutex);
+                while (queue.empty() && !stopping) {
+                    queueReady.wait(lock);
+                }
+                if (queue.empty()) {
+                    return;
+                }
+                conn = queue.front();
+                queue.pop_front();
+            }
+            processConnection(*conn);
+        }
+    }
+
+    // Runs the connection's pending lines one after another
+    void processConnection(Connection& conn) {
+        while (true) {
+            std::string line;
+            {
+                std::lock_guard<std::mutex> guard(conn.mutex);
+                if (conn.pendingLines.empty() || conn.closing) {
+                    conn.busy = false;
+                    break;
+                }
+                line = conn.pendingLines.front();
+                conn.pendingLines.pop_front();
+            }
+
+            std::ostringstream out;
+            bool quit = (line == "quit");
+            if (quit) {
+                out << "ok\tquit\n";
+            } else {
+                commands(conn.session, line, out);
+            }
+
+            std::lock_guard<std::mutex> guard(conn.mutex);
+            conn.outBuffer += out.str();
+            conn.flush();
+            if (quit) {
+                conn.closing = true;
+                conn.pendingLines.clear();
+            }
+        }
+        markDirty(conn.fd); // Arm EPOLLOUT for leftovers, or drop the connection
+    }
+
+    // Re-evaluates what the event loop waits for on a connection, or drops it
+    void update(const std::shared_ptr<Connection>& conn) {
+        uint32_t events = 0;
+        {
+            std::lock_guard<std::mutex> guard(conn->mutex);
+            if (conn->finished() || (conn->hungUp && !conn->busy)) {
+                drop(conn->fd); // A hung-up peer cannot receive unsent replies anyway
+                return;
+            }
+            if (conn->hungUp) {
+                return; // EPOLLHUP cannot be masked; the worker drops it through markDirty when done
+            }
+            if (!conn->inputClosed && !conn->closing && conn->outBuffer.size() < MAX_OUTPUT_BACKLOG) {
+                events |= EPOLLIN;
+            }
+            if (!conn->outBuffer.empty()) {
+                events |= EPOLLOUT;
+            }
+        }
+        epoll_event event;
+        memset(&event, 0, sizeof(event));
+        event.events = events;
+        event.data.fd = conn->fd;
+        epoll_ctl(epollFd, EPOLL_CTL_MOD, conn->fd, &event);
+    }
+
+    void drop(int fd) {
+        epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, NULL);
+        connections.erase(fd); // The socket is closed once a worker still holding it lets go
+    }
+
+    void acceptConnections() {
+        while (true) {
+            int fd = accept4(listenFd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (fd < 0) {
+                return; // EAGAIN: accepted everything that was waiting
+            }
+            epoll_event event;
+            memset(&event, 0, sizeof(event));
+            event.events = EPOLLIN;
+            event.data.fd = fd;
+            if (epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event) != 0) {
+                close(fd);
+                continue;
+            }
+            connections[fd] = std::shared_ptr<Connection>(new Connection(fd, trustClients));
+        }
+    }
+
+    // Reads what the client sent and queues every complete line
+    void readConnection(const std::shared_ptr<Connection>& conn) {
+        char buffer[16384];
+        bool closed = false;
+        while (true) {
+            ssize_t received = recv(conn->fd, buffer, sizeof(buffer), 0);
+            if (received > 0) {
+                conn->inBuffer.append(buffer, static_cast<size_t>(received));
+                continue;
+            }
+            if (received < 0 && errno == EINTR) {
+                continue;
+            }
+            closed = (received == 0 || (errno != EAGAIN && errno != EWOULDBLOCK));
+            break;
+        }
+
+        std::vector<std::string> lines;
+        size_t begin = 0;
+        size_t end;
+        while ((end = conn->inBuffer.find('\n', begin)) != std::string::npos) {
+            std::string line = conn->inBuffer.substr(begin, end - begin);
+            if (!line.empty() && line[line.size() - 1] == '\r') {
+                line.erase(line.size() - 1);
+            }
+            if (line.find_first_not_of(" \t") != std::string::npos) {
+                lines.push_back(line);
+            }
+            begin = end + 1;
+        }
+        conn->inBuffer.erase(0, begin);
+
+        {
+            std::lock_guard<std::mutex> guard(conn->mutex);
+            if (conn->inBuffer.size() > MAX_REQUEST_LINE) {
+                conn->outBuffer += "error\t-\tline_too_long\n";
+                conn->flush();
+                conn->closing = true;
+            }
+            conn->pendingLines.insert(conn->pendingLines.end(), lines.begin(), lines.end());
+            conn->inputClosed = conn->inputClosed || closed;
+            if (!conn->pendingLines.empty() && !conn->busy && !conn->closing) {
+                conn->busy = true;
+                enqueue(conn);
+            }
+        }
+        update(conn);
+    }
+
+    void writeConnection(const std::shared_ptr<Connection>& conn) {
+        {
+            std::lock_guard<std::mutex> guard(conn->mutex);
+            conn->flush();
+        }
+        update(conn);
+    }
+
+    // Picks up the connections the workers flagged
+    void handleDirty() {
+        uint64_t count;
+        ssize_t ignored = read(serverWakeFd, &count, sizeof(count));
+        (void)ignored;
+        std::vector<int> fds;
+        {
+            std::lock_guard<std::mutex> guard(dirtyMutex);
+            fds.swap(dirtyFds);
+        }
+        for (size_t i = 0; i < fds.size(); ++i) {
+            std::map<int, std::shared_ptr<Connection> >::iterator it = connections.find(fds[i]);
+            if (it != connections.end()) {
+                std::shared_ptr<Connection> conn = it->second;
+                update(conn);
+            }
+        }
+    }
+
+    // Binds a TCP port on 127.0.0.1 (all digits) or a Unix socket path
+    bool listenOn(const std::string& address) {
+        if (!address.empty() && address.find_first_not_of("0123456789") == std::string::npos) {
+            unsigned long port = std::strtoul(address.c_str(), NULL, 10);
+            if (port == 0 || port > 65535) {
+                std::cerr << "Error: Invalid port " << address << ".\n";
+                return false;
+            }
+            listenFd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+            int reuse = 1;
+            setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+            sockaddr_in addr;
+            memset(&addr, 0, sizeof(addr));
+            addr.sin_family = AF_INET;
+            addr.sin_port = htons(static_cast<uint16_t>(port));
+            addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            if (bind(listenFd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+                std::cerr << "Error: Could not bind 127.0.0.1:" << address << ".\n";
+                return false;
+            }
+        } else {
+            sockaddr_un addr;
+            memset(&addr, 0, sizeof(addr));
+            if (address.empty() || address.size() >= sizeof(addr.sun_path)) {
+                std::cerr << "Error: Invalid socket path " << address << ".\n";
+                return false;
+            }
+            addr.sun_family = AF_UNIX;
+            strncpy(addr.sun_path, address.c_str(), sizeof(addr.sun_path) - 1);
+            listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+            unlink(address.c_str()); // Left behind by a previous run
+            if (bind(listenFd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+                std::cerr << "Error: Could not bind " << address << ".\n";
+                return false;
+            }
+            unixPath = address;
+        }
+        if (listen(listenFd, SOMAXCONN) != 0) {
+            std::cerr << "Error: Could not listen on " << address << ".\n";
+            return false;
+        }
+        return true;
+    }
+
+public:
+    Server(Commands& commands, bool trustClients)
+        : commands(commands), trustClients(trustClients), listenFd(-1), epollFd(-1), stopping(false) {}
+
+    ~Server() {
+        if (listenFd >= 0) {
+            close(listenFd);
+        }
+        if (epollFd >= 0) {
+            close(epollFd);
+        }
+        if (serverWakeFd >= 0) {
+            close(serverWakeFd);
+            serverWakeFd = -1;
+        }
+        if (!unixPath.empty()) {
+            unlink(unixPath.c_str());
+        }
+    }
+
+    // Serves clients until SIGINT/SIGTERM. Returns the process exit code.
+    int run(const std::string& address, size_t workerCount) {
+        if (!listenOn(address)) {
+            return 1;
+        }
+        epollFd = epoll_create1(EPOLL_CLOEXEC);
+        serverWakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        epoll_event event;
+        memset(&event, 0, sizeof(event));
+        event.events = EPOLLIN;
+        event.data.fd = listenFd;
+        epoll_ctl(epollFd, EPOLL_CTL_ADD, listenFd, &event);
+        event.data.fd = serverWakeFd;
+        epoll_ctl(epollFd, EPOLL_CTL_ADD, serverWakeFd, &event);
+
+        signal(SIGPIPE, SIG_IGN);
+        signal(SIGINT, handleServerSignal);
+        signal(SIGTERM, handleServerSignal);
+
+        for (size_t i = 0; i < workerCount; ++i) {
+            workers.push_back(std::thread(&Server::runWorker, this));
+        }
+        std::cerr << "Serving on " << address << " with " << workerCount << " workers.\n";
+
+        epoll_event events[128];
+        while (!serverStopRequested) {
+            int ready = epoll_wait(epollFd, events, 128, -1);
+            for (int i = 0; i < ready; ++i) {
+                int fd = events[i].data.fd;
+                if (fd == listenFd) {
+                    acceptConnections();
+                    continue;
+                }
+                if (fd == serverWakeFd) {
+                    handleDirty();
+                    continue;
+                }
+                std::map<int, std::shared_ptr<Connection> >::iterator it = connections.find(fd);
+                if (it == connections.end()) {
+                    continue;
+                }
+                std::shared_ptr<Connection> conn = it->second;
+                if (events[i].events & EPOLLERR) {
+                    drop(fd);
+                } else if (events[i].events & EPOLLHUP) {
+                    readConnection(conn); // Queue whatever arrived before the hang-up
+                    if (connections.count(fd) != 0) {
+                        conn->hungUp = true;
+                        epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, NULL);
+                        update(conn);
+                    }
+                } else if (events[i].events & EPOLLIN) {
+                    readConnection(conn);
+                } else if (events[i].events & EPOLLOUT) {
+                    writeConnection(conn);
+                }
+            }
+        }
+
+        std::cerr << "Shutting down.\n";
+        {
+            std::lock_guard<std::mutex> guard(queueMutex);
+            stopping = true;
+            queueReady.notify_all();
+        }
+        for (size_t i = 0; i < workers.size(); ++i) {
+            workers[i].join(); // Commands already queued still run and are journaled
+        }
+        connections.clear();
+        return 0;
+    }
+};
+
+// --- Shard Router ---
+//
+// Sharded mode splits the network across N shard processes by a hash of the username
+// (shardOfUser). A shard is an ordinary server started with --shard <i>/<N>: it keeps the users it
+// owns, their friend lists and their posts in its own directory. A friend owned by another shard
+// is a stand-in user there (User::isRemote), so every shard can serve its part of a feed or a
+// friend-scoped search on its own. The router speaks the client protocol and:
+//  - sends each mutation to the shard that owns the acting user;
+//  - changes a cross-shard friendship on both shards, one half after the other, and undoes the
+//    first half if the second fails. Changes to one pair are serialized. Each shard journals an
+//    intent before it changes its half and keeps it pending until the router settles the pair, so
+//    a half left behind by a failed undo or a crashed shard or router is not lost: the router's
+//    reconciler lists the pending pairs at startup and every ROUTER_RECONCILE_SECONDS, makes the
+//    other half match, and settles both;
+//  - fans feeds and friend-scoped searches out to the owner and the shards that own friends (or to
+//    every shard), and merges the pages by post ID, which orders posts by time across shards.
+// Graph analytics need the whole graph and are not routed. Shards trust every client, so only
+// the router should be able to reach them (a loopback port or a Unix socket).
+
+const int SHARD_REPLY_TIMEOUT_SECONDS = 10; // A shard that takes longer counts as unavailable
+const size_t ROUTER_PAIR_LOCKS = 64;        // Stripes serializing changes to the same friendship
+const int ROUTER_RECONCILE_SECONDS = 5;     // Pause between the reconciler's rounds
+
+// Connects to an address as accepted by --serve: a TCP port on 127.0.0.1 or a Unix socket path.
+// Returns the socket, or -1.
+int connectToServer(const std::string& address) {
+    int fd;
+    int result;
+    if (!address.empty() && address.find_first_not_of("0123456789") == std::string::npos) {
+        sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(static_cast<uint16_t>(std::strtoul(address.c_str(), NULL, 10)));
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        result = connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr));
+    } else {
+        sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        if (address.size() >= sizeof(addr.sun_path)) {
+            return -1;
+        }
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, address.c_str(), sizeof(addr.sun_path) - 1);
+        fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        result = connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr));
+    }
+    if (fd >= 0 && result != 0) {
+        close(fd);
+        return -1;
+    }
+    if (fd >= 0) {
+        timeval timeout;
+        timeout.tv_sec = SHARD_REPLY_TIMEOUT_SECONDS;
+        timeout.tv_usec = 0;
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    }
+    return fd;
+}
+
+// A shard's reply to one command: its lines, the last of which is the ok or error line.
+// No lines when the shard could not be reached.
+struct ShardReply {
+    std::vector<std::string> lines;
+
+    bool ok() const {
+        return !lines.empty() && lines.back().compare(0, 3, "ok\t") == 0;
+    }
+
+    // "ok", the status of an error line, or shard_unavailable
+    std::string status() const {
+        if (lines.empty()) {
+            return opStatusName(OP_SHARD_UNAVAILABLE);
+        }
+        if (ok()) {
+            return "ok";
+        }
+        return lines.back().substr(lines.back().rfind('\t') + 1);
+    }
+
+    // Fields of the ok line after "ok" and the command name
+    std::vector<std::string> result() const {
+        std::vector<std::string> fields;
+        std::string rest = ok() ? lines.back() : std::string();
+        std::string::size_type start = rest.find('\t', 3);
+        while (start != std::string::npos) {
+            std::string::size_type end = rest.find('\t', start + 1);
+            fields.push_back(rest.substr(start + 1, end == std::string::npos ? std::string::npos : end - start - 1));
+            start = end;
+        }
+        return fields;
+    }
+};
+
+// One blocking connection from the router to a shard
+class ShardLink {
+private:
+    int fd;
+    std::string buffer; // Received bytes that are not part of a returned reply yet
+    bool peerClosed;    // The shard closed the connection before sending any part of a reply
+    ShardLink(const ShardLink&);
+    ShardLink& operator=(const ShardLink&);
+
+public:
+    explicit ShardLink(int fd) : fd(fd), peerClosed(false) {}
+    ~ShardLink() { close(fd); }
+
+    bool closedByPeer() const { return peerClosed; }
+
+    bool send(const std::string& line) {
+        std::string data = line + "\n";
+        size_t offset = 0;
+        while (offset < data.size()) {
+            ssize_t sent = ::send(fd, data.data() + offset, data.size() - offset, MSG_NOSIGNAL);
+            if (sent < 0 && errno == EINTR) {
+                continue;
+            }
+            if (sent <= 0) {
+                peerClosed = sent < 0 && (errno == EPIPE || errno == ECONNRESET);
+                return false;
+            }
+            offset += static_cast<size_t>(sent);
+        }
+        return true;
+    }
+
+    // Reads lines up to and including the next ok or error line
+    bool receive(ShardReply& reply) {
+        size_t begin = 0;
+        while (true) {
+            std::string::size_type end = buffer.find('\n', begin);
+            if (end == std::string::npos) {
+                buffer.erase(0, begin);
+                begin = 0;
+                char chunk[16384];
+                ssize_t received = recv(fd, chunk, sizeof(chunk), 0);
+                if (received < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (received <= 0) {
+                    peerClosed = reply.lines.empty() && buffer.empty()
+                              && (received == 0 || errno == ECONNRESET);
+                    return false; // Closed, failed or timed out
+                }
+                buffer.append(chunk, static_cast<size_t>(received));
+                continue;
+            }
+            reply.lines.push_back(buffer.substr(begin, end - begin));
+            begin = end + 1;
+            const std::string& line = reply.lines.back();
+            if (line.compare(0, 3, "ok\t") == 0 || line.compare(0, 6, "error\t") == 0) {
+                buffer.erase(0, begin);
+                return true;
+            }
+        }
+    }
+};
+
+// A post line of a shard's page, while pages are merged
+struct RoutedPost {
+    uint64_t id;
+    const std::string* line;
+};
+
+struct CompareRoutedPosts {
+    bool operator()(const RoutedPost& a, const RoutedPost& b) const {
+        return a.id > b.id; // Newest first
+    }
+};
+
+// A poster or term line of a shard's trending report
+struct RoutedCount {
+    std::string name;
+    uint64_t count;
+};
+
+struct CompareRoutedCounts {
+    bool operator()(const RoutedCount& a, const RoutedCount& b) const {
+        return a.count > b.count || (a.count == b.count && a.name < b.name);
+    }
+};
+
+// The router's command functor for Server: see the section comment
+class ShardRouter {
+private:
+    struct Shard {
+        std::string address;
+        std::mutex mutex; // Guards idle
+        std::vector<std::shared_ptr<ShardLink> > idle;
+    };
+
+    std::vector<Shard> shards;
+    std::mutex pairLocks[ROUTER_PAIR_LOCKS];
+
+    // Reconciler thread, see reconcile()
+    std::thread reconciler;
+    std::mutex reconcilerMutex; // Guards stopping
+    std::condition_variable reconcilerWake;
+    bool stopping;
+
+    ShardRouter(const ShardRouter&);
+    ShardRouter& operator=(const ShardRouter&);
+
+    uint32_t owner(const std::string& username) const {
+        return shardOfUser(username, static_cast<uint32_t>(shards.size()));
+    }
+
+    // The stripe serializing changes to the friendship of the two users, in either order
+    std::mutex& pairLock(const std::string& user1, const std::string& user2) {
+        return pairLocks[(hashString(std::min(user1, user2)) * 31 + hashString(std::max(user1, user2))) % ROUTER_PAIR_LOCKS];
+    }
+
+    // An idle connection to the shard ('pooled'), or a new one; NULL if the shard cannot be reached
+    std::shared_ptr<ShardLink> acquire(uint32_t shard, bool& pooled) {
+        {
+            std::lock_guard<std::mutex> guard(shards[shard].mutex);
+            pooled = !shards[shard].idle.empty();
+            if (pooled) {
+                std::shared_ptr<ShardLink> link = shards[shard].idle.back();
+                shards[shard].idle.pop_back();
+                return link;
+            }
+        }
+        int fd = connectToServer(shards[shard].address);
+        return fd < 0 ? std::shared_ptr<ShardLink>() : std::shared_ptr<ShardLink>(new ShardLink(fd));
+    }
+
+    void release(uint32_t shard, const std::shared_ptr<ShardLink>& link) {
+        std::lock_guard<std::mutex> guard(shards[shard].mutex);
+        shards[shard].idle.push_back(link);
+    }
+
+    // Sends lines[i] to shards targets[i], all before waiting for any reply, so the shards work in
+    // parallel. A connection that fails is dropped and its reply left empty. A pooled connection
+    // that the shard had closed while it was idle (e.g. it restarted) never delivered the command,
+    // so the command is sent again once on a new connection.
+    std::vector<ShardReply> requestAll(const std::vector<uint32_t>& targets, const std::vector<std::string>& lines) {
+        std::vector<std::shared_ptr<ShardLink> > links(targets.size());
+        std::vector<char> pooled(targets.size(), 0);
+        for (size_t i = 0; i < targets.size(); ++i) {
+            bool reused = false;
+            links[i] = acquire(targets[i], reused);
+            pooled[i] = reused;
+            if (links[i] && !links[i]->send(lines[i]) && !links[i]->closedByPeer()) {
+                links[i].reset();
+            }
+        }
+        std::vector<ShardReply> replies(targets.size());
+        for (size_t i = 0; i < targets.size(); ++i) {
+            if (!links[i]) {
+                continue;
+            }
+            if (!links[i]->closedByPeer() && links[i]->receive(replies[i])) {
+                release(targets[i], links[i]);
+                continue;
+            }
+            replies[i].lines.clear();
+            if (pooled[i] && links[i]->closedByPeer()) {
+                {
+                    std::lock_guard<std::mutex> guard(shards[targets[i]].mutex);
+                    shards[targets[i]].idle.clear(); // Likely closed as well
+                }
+                int fd = connectToServer(shards[targets[i]].address);
+                links[i] = fd < 0 ? std::shared_ptr<ShardLink>() : std::shared_ptr<ShardLink>(new ShardLink(fd));
+                if (links[i] && links[i]->send(lines[i]) && links[i]->receive(replies[i])) {
+                    release(targets[i], links[i]);
+                } else {
+                    replies[i].lines.clear();
+                }
+            }
+        }
+        return replies;
+    }
+
+    ShardReply request(uint32_t shard, const std::string& line) {
+        return requestAll(std::vector<uint32_t>(1, shard), std::vector<std::string>(1, line))[0];
+    }
+
+    // Writes a shard's reply to a forwarded command
+    static void relay(const ShardReply& reply, const std::string& command, std::ostream& out) {
+        if (reply.lines.empty()) {
+            out << "error\t" << command << "\t" << opStatusName(OP_SHARD_UNAVAILABLE) << "\n";
+        }
+        for (size_t i = 0; i < reply.lines.size(); ++i) {
+            out << reply.lines[i] << "\n";
+        }
+    }
+
+    // checkActor by name: router sessions know who is logged in, but not the user's ID
+    static OpStatus checkActorName(const Session& session, const std::string& actor) {
+        if (!session.trusted && session.name.empty()) {
+            return OP_NOT_LOGGED_IN;
+        }
+        if (actor.empty()) {
+            return OP_NO_SUCH_USER;
+        }
+        return (session.trusted || session.name == actor) ? OP_OK : OP_FORBIDDEN;
+    }
+
+    // The user's owner followed by the other shards that own friends of the user (see
+    // SocialNetwork::friendShards). Returns the owner's status.
+    std::string feedShards(const std::string& user, std::vector<uint32_t>& targets) {
+        ShardReply reply = request(owner(user), "shards " + user);
+        if (!reply.ok()) {
+            return reply.status();
+        }
+        targets.assign(1, owner(user));
+        std::vector<std::string> fields = reply.result();
+        for (size_t i = 0; i < fields.size(); ++i) {
+            targets.push_back(static_cast<uint32_t>(std::strtoul(fields[i].c_str(), NULL, 10)));
+        }
+        return "ok";
+    }
+
+    std::vector<uint32_t> allShards() const {
+        std::vector<uint32_t> targets;
+        for (size_t i = 0; i < shards.size(); ++i) {
+            targets.push_back(static_cast<uint32_t>(i));
+        }
+        return targets;
+    }
+
+    // Merges the shards' pages of one feed or search into a page of 'limit' posts, newest first.
+    // Each shard's page holds its newest 'limit' matching posts before the cursor, so the merged
+    // page is exact. Only the first reply may report a missing user: the others come from shards
+    // that have no stand-in for the user (no friends there).
+    static void mergePages(const std::string& command, const std::vector<ShardReply>& replies, size_t limit, std::ostream& out) {
+        std::vector<RoutedPost> posts;
+        bool more = false;
+        for (size_t i = 0; i < replies.size(); ++i) {
+            const ShardReply& reply = replies[i];
+            if (!reply.ok()) {
+                if (i > 0 && reply.status() == opStatusName(OP_NO_SUCH_USER)) {
+                    continue;
+                }
+                out << "error\t" << command << "\t" << reply.status() << "\n";
+                return;
+            }
+            for (size_t line = 0; line + 1 < reply.lines.size(); ++line) {
+                RoutedPost post = { std::strtoull(reply.lines[line].c_str() + 5, NULL, 10), &reply.lines[line] }; // "post\t<id>\t..."
+                posts.push_back(post);
+            }
+            std::vector<std::string> result = reply.result(); // <count>  <next cursor or ->
+            more = more || (result.size() == 2 && result[1] != "-");
+        }
+        std::sort(posts.begin(), posts.end(), CompareRoutedPosts());
+        if (posts.size() > limit) {
+            posts.resize(limit);
+            more = true;
+        }
+        for (size_t i = 0; i < posts.size(); ++i) {
+            out << *posts[i].line << "\n";
+        }
+        out << "ok\t" << command << "\t" << posts.size() << "\t";
+        if (more && !posts.empty()) {
+            out << posts.back().id;
+        } else {
+            out << "-";
+        }
+        out << "\n";
+    }
+
+    // Merges the shards' trending reports: posters are disjoint (each belongs to one shard), term
+    // counts are added up. A term only shows up where it made a shard's own top list, so its total
+    // is a lower bound.
+    static void mergeTrending(const std::vector<ShardReply>& replies, size_t limit, std::ostream& out) {
+        std::vector<RoutedCount> posters;
+        std::map<std::string, uint64_t> terms;
+        uint64_t posts = 0;
+        std::string window;
+        for (size_t i = 0; i < replies.size(); ++i) {
+            const ShardReply& reply = replies[i];
+            if (!reply.ok()) {
+                out << "error\ttrending\t" << reply.status() << "\n";
+                return;
+            }
+            for (size_t line = 0; line + 1 < reply.lines.size(); ++line) {
+                const std::string& text = reply.lines[line];
+                std::string::size_type first = text.find('\t');
+                std::string::size_type last = text.rfind('\t');
+                RoutedCount count = { text.substr(first + 1, last - first - 1), std::strtoull(text.c_str() + last + 1, NULL, 10) };
+                if (text.compare(0, first, "poster") == 0) {
+                    posters.push_back(count);
+                } else {
+                    terms[count.name] += count.count;
+                }
+            }
+            std::vector<std::string> result = reply.result(); // <window>  <posts>
+            if (result.size() == 2) {
+                window = result[0];
+                posts += std::strtoull(result[1].c_str(), NULL, 10);
+            }
+        }
+        std::vector<RoutedCount> termCounts;
+        for (std::map<std::string, uint64_t>::const_iterator it = terms.begin(); it != terms.end(); ++it) {
+            RoutedCount count = { it->first, it->second };
+            termCounts.push_back(count);
+        }
+        std::sort(posters.begin(), posters.end(), CompareRoutedCounts());
+        std::sort(termCounts.begin(), termCounts.end(), CompareRoutedCounts());
+        for (size_t i = 0; i < posters.size() && i < limit; ++i) {
+            out << "poster\t" << posters[i].name << "\t" << posters[i].count << "\n";
+        }
+        for (size_t i = 0; i < termCounts.size() && i < limit; ++i) {
+            out << "term\t" << termCounts[i].name << "\t" << termCounts[i].count << "\n";
+        }
+        out << "ok\ttrending\t" << window << "\t" << posts << "\n";
+    }
+
+    // Adds or removes a friendship between users of two different shards; see the section comment.
+    // Returns the status name.
+    std::string changeFriendship(const std::string& user, const std::string& friendName, bool link) {
+        uint32_t userShard = owner(user);
+        uint32_t friendShard = owner(friendName);
+        std::lock_guard<std::mutex> pairGuard(pairLock(user, friendName));
+        // Whether the friend exists, without making the shard a stand-in for a typo: an empty profile
+        // page is just a lookup, and a page size of 0 is valid (profilePage returns no cursor for it)
+        ShardReply friendExists = request(friendShard, "profile " + friendName + " 0");
+        if (!friendExists.ok()) {
+            return friendExists.status();
+        }
+        std::string settled = opStatusName(link ? OP_ALREADY_FRIENDS : OP_NOT_FRIENDS);
+        std::string verb = link ? "link " : "unlink ";
+        std::string first = request(userShard, verb + user + " " + friendName).status();
+        if (first != "ok" && first != settled) {
+            return first; // If only the reply was lost, the shard's pending intent covers it
+        }
+        std::string second = request(friendShard, verb + friendName + " " + user).status();
+        if (second != "ok" && second != settled) {
+            if (first == "ok") {
+                std::string undo = request(userShard, (link ? "unlink " : "link ") + user + " " + friendName).status();
+                if (undo != "ok" && undo != opStatusName(link ? OP_NOT_FRIENDS : OP_ALREADY_FRIENDS)) {
+                    std::cerr << "Warning: could not undo " << verb << user << " " << friendName << " (" << undo
+                              << "); the reconciler will complete it instead.\n";
+                }
+            }
+            return second; // The pair stays pending: whichever state the halves ended in, reconcile() aligns them
+        }
+        request(friendShard, "settle " + friendName + " " + user); // One that fails stays pending for reconcile()
+        request(userShard, "settle " + user + " " + friendName);
+        return (first == "ok" || second == "ok") ? "ok" : settled; // Either half changing repairs a lone half
+    }
+
+    // Makes the other half of one pending pair of 'shard' match the current state of the pending
+    // half, then settles both. Returns true if the pair was settled.
+    bool reconcilePair(uint32_t shard, const std::string& user, const std::string& remote) {
+        std::lock_guard<std::mutex> pairGuard(pairLock(user, remote));
+        ShardReply current = request(shard, "pending " + user); // Under the pair lock, so it cannot change now
+        std::string prefix = "pending\t" + user + "\t" + remote + "\t";
+        std::string state;
+        for (size_t i = 0; i + 1 < current.lines.size(); ++i) {
+            if (current.lines[i].compare(0, prefix.size(), prefix) == 0) {
+                state = current.lines[i].substr(prefix.size());
+            }
+        }
+        if (!current.ok() || state.empty()) {
+            return false; // Unreachable, or settled meanwhile
+        }
+        bool linked = state == "linked";
+        uint32_t remoteShard = owner(remote);
+        std::string other = request(remoteShard, (linked ? "link " : "unlink ") + remote + " " + user).status();
+        if (other == opStatusName(OP_NO_SUCH_USER)) {
+            // The stand-in names nobody on its owner (e.g. a trusted client linked a typo): drop this half
+            std::string local = request(shard, "unlink " + user + " " + remote).status();
+            if (local != "ok" && local != opStatusName(OP_NOT_FRIENDS)) {
+                return false;
+            }
+            return request(shard, "settle " + user + " " + remote).ok();
+        }
+        if (other != "ok" && other != opStatusName(linked ? OP_ALREADY_FRIENDS : OP_NOT_FRIENDS)) {
+            return false;
+        }
+        request(remoteShard, "settle " + remote + " " + user);
+        return request(shard, "settle " + user + " " + remote).ok();
+    }
+
+    // Settles the cross-shard friendships the shards still have pending (see
+    // SocialNetwork::pendingLinks): the pending half wins, being the latest change the shard made.
+    // Shards that cannot be reached keep theirs for the next round. Returns the pairs settled.
+    size_t reconcile() {
+        std::vector<uint32_t> targets = allShards();
+        std::vector<ShardReply> replies = requestAll(targets, std::vector<std::string>(targets.size(), "pending"));
+        size_t settledPairs = 0;
+        for (size_t shard = 0; shard < replies.size(); ++shard) {
+            if (!replies[shard].ok()) {
+                continue;
+            }
+            for (size_t i = 0; i + 1 < replies[shard].lines.size(); ++i) {
+                const std::string& line = replies[shard].lines[i]; // "pending\t<user>\t<remote>\t<state>"
+                std::string::size_type first = line.find('\t');
+                std::string::size_type second = line.find('\t', first + 1);
+                std::string::size_type third = line.find('\t', second + 1);
+                if (first == std::string::npos || second == std::string::npos || third == std::string::npos) {
+                    continue;
+                }
+                if (reconcilePair(static_cast<uint32_t>(shard), line.substr(first + 1, second - first - 1),
+                                  line.substr(second + 1, third - second - 1))) {
+                    ++settledPairs;
+                }
+            }
+        }
+        return settledPairs;
+    }
+
+    // Body of the reconciler thread: a round right away, then one every ROUTER_RECONCILE_SECONDS
+    void runReconciler() {
+        std::unique_lock<std::mutex> lock(reconcilerMutex);
+        while (!stopping) {
+            lock.unlock();
+            size_t settledPairs = reconcile();
+            if (settledPairs > 0) {
+                std::cerr << "Reconciled " << settledPairs << " cross-shard friendships.\n";
+            }
+            lock.lock();
+            if (!stopping) {
+                reconcilerWake.wait_for(lock, std::chrono::seconds(ROUTER_RECONCILE_SECONDS));
+            }
+        }
     }
 
-    // Helper to generate a unique post ID using stringstream (more compatible than std::to_string for some compilers)
-    std::string generatePostId() {
-        std::ostringstream oss;
-        oss << "post_" << (posts.size() + 1);
-        return oss.str();
+public:
+    // 'addresses' lists the shard servers in shard order
+    explicit ShardRouter(const std::vector<std::string>& addresses) : shards(addresses.size()), stopping(false) {
+        for (size_t i = 0; i < addresses.size(); ++i) {
+            shards[i].address = addresses[i];
+        }
     }
 
-public:
-    // Constructor: loads data from files when the SocialNetwork object is created
-    SocialNetwork() : loggedInUser("") {
-        loadData();
+    ~ShardRouter() {
+        {
+            std::lock_guard<std::mutex> guard(reconcilerMutex);
+            stopping = true;
+            reconcilerWake.notify_all();
+        }
+        if (reconciler.joinable()) {
+            reconciler.join();
+        }
     }
 
-    // Destructor: saves data to files when the SocialNetwork object is destroyed
-    ~SocialNetwork() {
-        saveData();
+    // Starts settling the shards' pending cross-shard friendships in the background
+    void startReconciler() {
+        reconciler = std::thread(&ShardRouter::runReconciler, this);
     }
 
-    // --- Data Management (Load/Save) ---
+    // Runs one client command line, like runCommand does for a single network
+    void operator()(Session& session, const std::string& line, std::ostream& out) {
+        std::string rest = line;
+        std::string command = nextWord(rest);
+        std::string status = "ok";
 
-    // Loads user, friendship, and post data from respective text files
-    void loadData() {
-        // Load Users
-        // Using .c_str() for compatibility with older compilers for ifstream constructor
-        std::ifstream userFile(USERS_FILE.c_str());
-        if (userFile.is_open()) {
-            std::string line;
-            while (std::getline(userFile, line)) {
-                std::stringstream ss(line);
-                std::string username, password, bio;
-                std::getline(ss, username, '|');
-                std::getline(ss, password, '|');
-                std::getline(ss, bio); // Bio is the rest of the line
-                users.push_back(User(username, password, bio)); // Changed to push_back
+        if (command == "register" || command == "profile" || command == "friends") {
+            std::string username = nextWord(rest);
+            relay(request(owner(username), line), command, out);
+        } else if (command == "login") {
+            std::string username = nextWord(rest);
+            ShardReply reply = request(owner(username), line);
+            if (reply.ok()) {
+                session.name = username;
             }
-            userFile.close();
-            std::cout << "Users loaded from " << USERS_FILE << "\n";
-        } else {
-            std::cout << "No existing users file found. Creating new one.\n";
-        }
-
-        // Load Friendships
-        std::ifstream friendshipFile(FRIENDSHIPS_FILE.c_str());
-        if (friendshipFile.is_open()) {
-            std::string line;
-            while (std::getline(friendshipFile, line)) {
-                std::stringstream ss(line);
-                std::string user1, user2;
-                std::getline(ss, user1, '|');
-                std::getline(ss, user2); // user2 is the rest of the line
-                friendships[user1].push_back(user2);
-                friendships[user2].push_back(user1); // Friendships are mutual
+            relay(reply, command, out);
+        } else if (command == "logout") {
+            session.name.clear();
+            out << "ok\tlogout\n";
+        } else if (command == "post") {
+            std::string author = nextWord(rest);
+            status = opStatusName(checkActorName(session, author));
+            if (status == "ok") {
+                relay(request(owner(author), line), command, out);
             }
-            friendshipFile.close();
-            std::cout << "Friendships loaded from " << FRIENDSHIPS_FILE << "\n";
-        } else {
-            std::cout << "No existing friendships file found. Creating new one.\n";
-        }
-
-        // Load Posts
-        std::ifstream postFile(POSTS_FILE.c_str());
-        if (postFile.is_open()) {
-            std::string line;
-            while (std::getline(postFile, line)) {
-                std::stringstream ss(line);
-                std::string postId, username, timestamp, content;
-                std::getline(ss, postId, '|');
-                std::getline(ss, username, '|');
-                std::getline(ss, timestamp, '|');
-                std::getline(ss, content); // Content is the rest of the line
-                posts.push_back(Post(postId, username, content, timestamp)); // Changed to push_back
+        } else if (command == "friend" || command == "unfriend") {
+            std::string username = nextWord(rest);
+            std::string friendName = nextWord(rest);
+            status = opStatusName(checkActorName(session, username));
+            if (status == "ok" && owner(username) == owner(friendName)) {
+                relay(request(owner(username), line), command, out);
+            } else if (status == "ok") {
+                status = friendName.empty() ? opStatusName(OP_NO_SUCH_USER) : changeFriendship(username, friendName, command == "friend");
+                if (status == "ok") {
+                    out << "ok\t" << command << "\t" << username << "\t" << friendName << "\n";
+                }
             }
-            postFile.close();
-            std::cout << "Posts loaded from " << POSTS_FILE << "\n";
-        } else {
-            std::cout << "No existing posts file found. Creating new one.\n";
-        }
-    }
-
-    // Saves user, friendship, and post data to respective text files
-    void saveData() const {
-        // Save Users
-        // Using .c_str() for compatibility with older compilers for ofstream constructor
-        std::ofstream userFile(USERS_FILE.c_str());
-        if (userFile.is_open()) {
-            for (size_t i = 0; i < users.size(); ++i) { // Changed to index-based loop
-                userFile << users[i].username << "|" << users[i].password << "|" << sanitizeString(users[i].bio) << "\n";
+        } else if (command == "feed" || command == "search") {
+            std::string scope = nextWord(rest);
+            std::string limitWord = nextWord(rest);
+            std::string cursorWord = nextWord(rest);
+            uint32_t limit = static_cast<uint32_t>(FEED_PAGE_SIZE);
+            std::vector<uint32_t> targets;
+            if (!parseNumberArg(limitWord, limit) || (!cursorWord.empty() && cursorWord != "-" && parsePostId(cursorWord) == 0)) {
+                status = opStatusName(OP_INVALID_ARGUMENT);
+            } else if (command == "search" && scope == "all") {
+                targets = allShards();
+            } else {
+                status = opStatusName(checkActorName(session, scope)); // A feed and a friend-scoped search are private
+                if (status == "ok") {
+                    status = feedShards(scope, targets);
+                }
             }
-            userFile.close();
-            std::cout << "Users saved to " << USERS_FILE << "\n";
-        } else {
-            std::cerr << "Error: Could not open " << USERS_FILE << " for writing.\n";
-        }
-
-        // Save Friendships (avoid duplicates by only saving one direction, e.g., A|B but not B|A)
-        std::ofstream friendshipFile(FRIENDSHIPS_FILE.c_str());
-        if (friendshipFile.is_open()) {
-            std::map<std::string, std::vector<std::string> > savedPairs; // Added space here
-            for (std::map<std::string, std::vector<std::string> >::const_iterator pair_it = friendships.begin(); pair_it != friendships.end(); ++pair_it) { // Added space here
-                const std::string& user1 = pair_it->first;
-                for (size_t i = 0; i < pair_it->second.size(); ++i) { // Changed to index-based loop
-                    const std::string& user2 = pair_it->second[i];
-                    // Check if the reverse pair (user2, user1) has already been saved
-                    // This prevents saving A|B and B|A as separate entries if they are mutual
-                    if (savedPairs.find(user2) == savedPairs.end() ||
-                        std::find(savedPairs[user2].begin(), savedPairs[user2].end(), std::string(user1)) == savedPairs[user2].end()) { // Explicitly construct std::string
-                        friendshipFile << user1 << "|" << user2 << "\n";
+            if (status == "ok") {
+                std::string forwarded = command + " " + scope + " " + (limitWord.empty() ? "-" : limitWord) + " "
+                                      + (cursorWord.empty() ? "-" : cursorWord) + (command == "search" ? " " + rest : "");
+                mergePages(command, requestAll(targets, std::vector<std::string>(targets.size(), forwarded)), limit, out);
+            }
+        } else if (command == "mutual") {
+            std::string username = nextWord(rest);
+            std::string otherName = nextWord(rest);
+            std::vector<uint32_t> targets;
+            targets.push_back(owner(username));
+            targets.push_back(owner(otherName));
+            std::vector<std::string> lines;
+            lines.push_back("friends " + username);
+            lines.push_back("friends " + otherName);
+            std::vector<ShardReply> replies = requestAll(targets, lines);
+            if (!replies[0].ok() || !replies[1].ok()) {
+                status = replies[replies[0].ok() ? 1 : 0].status();
+            } else {
+                std::vector<std::string> friends[2];
+                for (size_t side = 0; side < 2; ++side) {
+                    for (size_t i = 0; i + 1 < replies[side].lines.size(); ++i) {
+                        friends[side].push_back(replies[side].lines[i].substr(7)); // "friend\t<name>"
                     }
+                    std::sort(friends[side].begin(), friends[side].end());
+                }
+                std::vector<std::string> common;
+                std::set_intersection(friends[0].begin(), friends[0].end(), friends[1].begin(), friends[1].end(),
+                                      std::back_inserter(common));
+                for (size_t i = 0; i < common.size(); ++i) {
+                    out << "friend\t" << common[i] << "\n";
                 }
-                savedPairs[user1] = pair_it->second; // Mark user1's friends as saved
+                out << "ok\tmutual\t" << common.size() << "\n";
             }
-            friendshipFile.close();
-            std::cout << "Friendships saved to " << FRIENDSHIPS_FILE << "\n";
+        } else if (command == "trending") {
+            nextWord(rest);
+            uint32_t limit = static_cast<uint32_t>(TRENDING_COUNT);
+            if (!parseNumberArg(nextWord(rest), limit)) {
+                status = opStatusName(OP_INVALID_ARGUMENT);
+            } else {
+                std::vector<uint32_t> targets = allShards();
+                mergeTrending(requestAll(targets, std::vector<std::string>(targets.size(), line)), limit, out);
+            }
+        } else if (command == "sync") {
+            std::vector<uint32_t> targets = allShards();
+            std::vector<ShardReply> replies = requestAll(targets, std::vector<std::string>(targets.size(), line));
+            for (size_t i = 0; i < replies.size() && status == "ok"; ++i) {
+                status = replies[i].status();
+            }
+            if (status == "ok") {
+                out << "ok\tsync\n";
+            }
+        } else if (command == "save") {
+            status = opStatusName(OP_FORBIDDEN);
+        } else if (command == "suggest" || command == "hops" || command == "community" || command == "components"
+                   || command == "stats") {
+            status = opStatusName(OP_UNSUPPORTED); // Need the whole graph; run them against a shard directly
         } else {
-            std::cerr << "Error: Could not open " << FRIENDSHIPS_FILE << " for writing.\n";
+            out << "error\t" << command << "\tunknown_command\n";
         }
 
-        // Save Posts
-        std::ofstream postFile(POSTS_FILE.c_str());
-        if (postFile.is_open()) {
-            for (size_t i = 0; i < posts.size(); ++i) { // Changed to index-based loop
-                postFile << posts[i].postId << "|" << posts[i].username << "|" << posts[i].timestamp << "|" << sanitizeString(posts[i].content) << "\n";
-            }
-            postFile.close();
-            std::cout << "Posts saved to " << POSTS_FILE << "\n";
-        } else {
-            std::cerr << "Error: Could not open " << POSTS_FILE << " for writing.\n";
+        if (status != "ok") {
+            out << "error\t" << command << "\t" << status << "\n";
         }
     }
+};
+#endif
 
-    // --- User Management ---
+#ifndef _WIN32
+// --- Benchmark Mode ---
+//
+// Generates deterministic synthetic networks of increasing size and times the main operations on
+// them. Each size gets its own directory under BENCH_DIR holding users.txt, friendships.txt and
+// posts.txt in the import format (plus the snapshot and journal the runs produce), so a dataset
+// can also be reused by hand. Friendship degrees follow a power law and posting activity a
+// Zipf distribution: a few hubs with many friends and prolific authors, a long tail of quiet users.
 
-    // Allows a new user to register with a unique username, password, and bio
-    void registerUser() {
-        std::string username, password, bio;
-        std::cout << "Enter desired username: ";
-        std::cin >> username;
-        // Clear the input buffer after reading username to prevent issues with subsequent getline
-        std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+const char* const BENCH_DIR = "bench_data";
+const size_t BENCH_AVERAGE_DEGREE = 20;     // Friendships per user (each edge counts for both ends)
+const size_t BENCH_POSTS_PER_USER = 10;
+const size_t BENCH_SAMPLES = 1000;          // Timed calls per cheap operation
+const double BENCH_DEGREE_EXPONENT = 0.6;   // Endpoint weights (rank+1)^-0.6: degree tail exponent ~2.7
+const double BENCH_ACTIVITY_EXPONENT = 1.0; // Classic Zipf for posting activity
 
-        if (userExists(username)) {
-            std::cout << "Username already taken. Please choose another.\n";
-            return;
-        }
+// SplitMix64: tiny, fast and fully deterministic across platforms (unlike std::rand)
+class BenchRandom {
+private:
+    uint64_t state;
 
-        std::cout << "Enter password: ";
-        std::cin >> password;
-        std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n'); // Clear buffer
+public:
+    explicit BenchRandom(uint64_t seed) : state(seed) {}
 
-        std::cout << "Enter a short bio (e.g., 'Loves coding'): ";
-        std::getline(std::cin, bio); // Use getline for bio as it can contain spaces
+    uint64_t next() {
+        uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        return z ^ (z >> 31);
+    }
 
-        users.push_back(User(username, password, bio)); // Changed to push_back
-        saveData(); // Save immediately after a new user is registered
-        std::cout << "User " << username << " registered successfully!\n";
+    // Uniform double in [0, 1)
+    double uniform() {
+        return static_cast<double>(next() >> 11) * (1.0 / 9007199254740992.0);
     }
 
-    // Allows an existing user to log in
-    bool loginUser() {
-        std::string username, password;
-        std::cout << "Enter username: ";
-        std::cin >> username;
-        std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n'); // Clear buffer
+    size_t below(size_t bound) {
+        return static_cast<size_t>(next() % bound);
+    }
+};
 
-        std::cout << "Enter password: ";
-        std::cin >> password;
-        std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n'); // Clear buffer
+// Draws indices 0..n-1 with probability proportional to (rank + 1)^-exponent. Ranks are shuffled
+// onto indices so the heavy users are spread over the ID space rather than all at the front.
+class ZipfSampler {
+private:
+    std::vector<double> cumulative;
+    std::vector<uint32_t> indexOfRank;
 
-        User* user = findUser(username);
-        if (user && user->password == password) {
-            loggedInUser = username;
-            std::cout << "Welcome, " << loggedInUser << "!\n";
-            return true;
-        } else {
-            std::cout << "Invalid username or password.\n";
-            return false;
+public:
+    ZipfSampler(size_t n, double exponent, BenchRandom& random) : cumulative(n), indexOfRank(n) {
+        double total = 0;
+        for (size_t rank = 0; rank < n; ++rank) {
+            total += std::pow(static_cast<double>(rank + 1), -exponent);
+            cumulative[rank] = total;
+            indexOfRank[rank] = static_cast<uint32_t>(rank);
+        }
+        for (size_t i = n; i > 1; --i) { // Fisher-Yates with our own generator, for determinism
+            std::swap(indexOfRank[i - 1], indexOfRank[random.below(i)]);
         }
     }
 
-    // Logs out the current user
-    void logoutUser() {
-        loggedInUser = "";
-        std::cout << "Logged out successfully.\n";
+    uint32_t sample(BenchRandom& random) const {
+        double target = random.uniform() * cumulative.back();
+        size_t rank = std::upper_bound(cumulative.begin(), cumulative.end(), target) - cumulative.begin();
+        return indexOfRank[std::min(rank, indexOfRank.size() - 1)];
     }
+};
 
-    // Checks if any user is currently logged in
-    bool isLoggedIn() const {
-        return !loggedInUser.empty();
-    }
+std::string benchUserName(uint32_t id) {
+    std::ostringstream oss;
+    oss << "user" << id;
+    return oss.str();
+}
 
-    // Returns the username of the currently logged-in user
-    std::string getLoggedInUser() const {
-        return loggedInUser;
+// Writes a synthetic network of 'userCount' users to the text files in the current directory
+bool generateBenchData(size_t userCount, uint64_t seed) {
+    BenchRandom random(seed);
+    std::ofstream userFile("users.txt");
+    std::ofstream friendshipFile("friendships.txt");
+    std::ofstream postFile("posts.txt");
+    if (!userFile.is_open() || !friendshipFile.is_open() || !postFile.is_open()) {
+        return false;
     }
 
-    // --- Friend Management ---
+    for (uint32_t id = 0; id < userCount; ++id) {
+        userFile << benchUserName(id) << "|pw" << id << "|Synthetic user number " << id << "\n";
+    }
 
-    // Allows the logged-in user to add another user as a friend
-    void addFriend() {
-        if (!isLoggedIn()) {
-            std::cout << "Please log in to add friends.\n";
-            return;
+    // Chung-Lu style: both endpoints drawn from the same heavy-tailed weights. Self loops are
+    // skipped; the few duplicate pairs are merged on import.
+    ZipfSampler degreeWeights(userCount, BENCH_DEGREE_EXPONENT, random);
+    size_t edgeCount = userCount * BENCH_AVERAGE_DEGREE / 2;
+    for (size_t i = 0; i < edgeCount; ++i) {
+        uint32_t user1 = degreeWeights.sample(random);
+        uint32_t user2 = degreeWeights.sample(random);
+        if (user1 != user2) {
+            friendshipFile << benchUserName(user1) << "|" << benchUserName(user2) << "\n";
         }
+    }
 
-        std::string friendUsername;
-        std::cout << "Enter username of person to add as friend: ";
-        std::cin >> friendUsername;
-        std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n'); // Clear buffer
+    ZipfSampler activity(userCount, BENCH_ACTIVITY_EXPONENT, random);
+    size_t postCount = userCount * BENCH_POSTS_PER_USER;
+    Timestamp timestamp = 1700000000LL * 1000000; // Fixed start, one post every 10 ms
+    for (size_t i = 0; i < postCount; ++i) {
+        timestamp += 10000;
+        postFile << "post_" << (i + 1) << "|" << benchUserName(activity.sample(random)) << "|" << timestamp
+                 << "|Synthetic post " << i << " with a bit of text to make it look like a status update\n";
+    }
 
-        if (friendUsername == loggedInUser) {
-            std::cout << "You cannot add yourself as a friend.\n";
-            return;
-        }
+    userFile.close();
+    friendshipFile.close();
+    postFile.close();
+    return userFile && friendshipFile && postFile;
+}
 
-        if (!userExists(friendUsername)) {
-            std::cout << "User " << friendUsername << " does not exist.\n";
-            return;
-        }
+// Latencies of one operation, in microseconds
+struct BenchSeries {
+    std::string name;
+    std::vector<double> samples;
 
-        // Check if already friends to avoid duplicates
-        std::map<std::string, std::vector<std::string> >::iterator it = friendships.find(loggedInUser); // Added space here
-        if (it != friendships.end()) {
-            if (std::find(it->second.begin(), it->second.end(), std::string(friendUsername)) != it->second.end()) { // Explicitly construct std::string
-                std::cout << "You are already friends with " << friendUsername << ".\n";
-                return;
-            }
-        }
+    explicit BenchSeries(const std::string& name) : name(name) {}
 
-        // Add friendship (mutual relationship)
-        friendships[loggedInUser].push_back(friendUsername);
-        friendships[friendUsername].push_back(loggedInUser);
-        saveData(); // Save immediately after adding a friend
-        std::cout << "You are now friends with " << friendUsername << "!\n";
+    double percentile(double fraction) const {
+        std::vector<double> sorted = samples;
+        std::sort(sorted.begin(), sorted.end());
+        size_t index = static_cast<size_t>(fraction * (sorted.size() - 1) + 0.5);
+        return sorted[index];
     }
+};
 
-    // Allows the logged-in user to remove a friend
-    void removeFriend() {
-        if (!isLoggedIn()) {
-            std::cout << "Please log in to remove friends.\n";
-            return;
-        }
-
-        std::string friendUsername;
-        std::cout << "Enter username of person to remove from friends: ";
-        std::cin >> friendUsername;
-        std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n'); // Clear buffer
-
-        std::map<std::string, std::vector<std::string> >::iterator it = friendships.find(loggedInUser); // Added space here
-        if (it == friendships.end()) {
-            std::cout << "You have no friends to remove.\n";
-            return;
-        }
+// Microseconds elapsed since 'start'
+double elapsedMicros(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+}
 
-        // Remove from current user's friend list
-        std::vector<std::string>& currentUsersFriends = it->second; // Changed to explicit reference
-        // Use std::remove-erase idiom to remove the friend
-        std::vector<std::string>::iterator friendIt = std::remove(currentUsersFriends.begin(), currentUsersFriends.end(), std::string(friendUsername)); // Explicitly construct std::string
-        if (friendIt == currentUsersFriends.end()) {
-            std::cout << "You are not friends with " << friendUsername << ".\n";
-            return;
-        }
-        currentUsersFriends.erase(friendIt, currentUsersFriends.end());
+// Peak resident set size of the process so far, in MiB
+double peakRssMiB() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+    return usage.ru_maxrss / (1024.0 * 1024.0); // Bytes on macOS
+#else
+    return usage.ru_maxrss / 1024.0;            // KiB elsewhere
+#endif
+}
 
-        // Remove from target user's friend list (if they exist in the map)
-        std::map<std::string, std::vector<std::string> >::iterator targetIt = friendships.find(friendUsername); // Added space here
-        if (targetIt != friendships.end()) {
-            std::vector<std::string>& targetUsersFriends = targetIt->second; // Changed to explicit reference
-            std::vector<std::string>::iterator targetFriendIt = std::remove(targetUsersFriends.begin(), targetUsersFriends.end(), std::string(loggedInUser)); // Explicitly construct std::string
-            targetUsersFriends.erase(targetFriendIt, targetUsersFriends.end());
-        }
+void printBenchSeries(const BenchSeries& series) {
+    std::printf("  %-24s %8lu %12.1f %12.1f %12.1f\n", series.name.c_str(),
+                static_cast<unsigned long>(series.samples.size()), series.percentile(0.5), series.percentile(0.99),
+                series.percentile(1.0));
+}
 
-        saveData(); // Save immediately after removing a friend
-        std::cout << "You have removed " << friendUsername << " from your friends.\n";
+// Generates one dataset in the current directory and times loading, saving, befriending and the
+// two page queries on it
+bool benchDataset(size_t userCount, const std::string& dirName) {
+    const char* stale[] = { "network.snap", "network.snap.corrupt", "journal.txt", "journal.compacting.txt" };
+    for (size_t i = 0; i < sizeof(stale) / sizeof(stale[0]); ++i) {
+        std::remove(stale[i]); // Every run starts from the text files alone
     }
 
-    // Displays the list of friends for a given username
-    void viewFriends(const std::string& username) const {
-        User* user = findUser(username); // Now calling const findUser
-        if (!user) {
-            std::cout << "User " << username << " not found.\n";
-            return;
-        }
-
-        std::cout << "--------------------------------\n";
-        std::cout << username << "'s Friends:\n";
-        std::map<std::string, std::vector<std::string> >::const_iterator it = friendships.find(username); // Added space here
-        if (it != friendships.end() && !it->second.empty()) {
-            for (size_t i = 0; i < it->second.size(); ++i) { // Changed to index-based loop
-                std::cout << "- " << it->second[i] << "\n";
-            }
-        } else {
-            std::cout << "(No friends yet)\n";
-        }
-        std::cout << "--------------------------------\n";
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    bool generated = generateBenchData(userCount, 42 + userCount);
+    double generateMicros = elapsedMicros(start);
+    if (!generated) {
+        std::cerr << "Error: Could not write the data files in " << dirName << ".\n";
+        return false;
     }
 
-    // --- Post Management ---
+    std::ostream quiet(NULL); // Swallows the network's progress messages
+    BenchSeries importText("loadData (text import)");
+    BenchSeries loadSnapshot("loadData (snapshot)");
+    BenchSeries save("saveData");
+    BenchSeries befriend("befriend");
+    BenchSeries durableBefriend("befriend + syncJournal");
+    BenchSeries profile("profilePage");
+    BenchSeries feed("feedPage");
+    BenchSeries cachedFeed("feedPage (cached)");
+    {
+        start = std::chrono::steady_clock::now();
+        SocialNetwork importer(quiet); // No snapshot yet: parses the text files and writes the first snapshot
+        importText.samples.push_back(elapsedMicros(start));
+    }
+    {
+        start = std::chrono::steady_clock::now();
+        SocialNetwork app(quiet);
+        loadSnapshot.samples.push_back(elapsedMicros(start));
 
-    // Allows the logged-in user to create and post a new message
-    void postMessage() {
-        if (!isLoggedIn()) {
-            std::cout << "Please log in to post messages.\n";
-            return;
+        BenchRandom random(7 + userCount);
+        for (size_t i = 0; i < BENCH_SAMPLES; ++i) {
+            UserId user = static_cast<UserId>(random.below(userCount));
+            UserId friendId = static_cast<UserId>(random.below(userCount));
+            start = std::chrono::steady_clock::now();
+            app.befriend(user, friendId);
+            befriend.samples.push_back(elapsedMicros(start));
         }
-
-        std::string content;
-        std::cout << "Enter your message (max 255 chars, no newlines): ";
-        std::getline(std::cin, content); // Use getline for message content to capture spaces
-
-        if (content.length() > 255) {
-            content = content.substr(0, 255); // Truncate if too long
-            std::cout << "Message truncated to 255 characters.\n";
+        for (size_t i = 0; i < BENCH_SAMPLES / 10; ++i) { // Each one waits for an fsync
+            UserId user = static_cast<UserId>(random.below(userCount));
+            UserId friendId = static_cast<UserId>(random.below(userCount));
+            start = std::chrono::steady_clock::now();
+            app.befriend(user, friendId);
+            app.syncJournal();
+            durableBefriend.samples.push_back(elapsedMicros(start));
         }
-
-        std::string postId = generatePostId();
-        posts.push_back(Post(postId, loggedInUser, content, getCurrentTimestamp())); // Changed to push_back
-        saveData(); // Save immediately after posting a message
-        std::cout << "Message posted successfully!\n";
-    }
-
-    // Views the profile and posts of a specified user
-    void viewProfile(const std::string& username) const {
-        User* user = findUser(username); // Now calling const findUser
-        if (user) {
-            user->displayProfile(); // Display user's bio
-            std::cout << "Posts by " << username << ":\n";
-            bool hasPosts = false;
-            for (size_t i = 0; i < posts.size(); ++i) { // Changed to index-based loop
-                if (posts[i].username == username) {
-                    posts[i].displayPost(); // Display each post by this user
-                    hasPosts = true;
-                }
-            }
-            if (!hasPosts) {
-                std::cout << "(No posts yet)\n";
-            }
-        } else {
-            std::cout << "User " << username << " not found.\n";
+        for (size_t i = 0; i < BENCH_SAMPLES; ++i) {
+            UserId user = static_cast<UserId>(random.below(userCount));
+            PostHandle nextCursor = NO_POST;
+            start = std::chrono::steady_clock::now();
+            app.profilePage(user, PROFILE_PAGE_SIZE, NO_POST, nextCursor);
+            profile.samples.push_back(elapsedMicros(start));
         }
-    }
-
-    // Displays the social feed for the logged-in user (their posts and their friends' posts)
-    void viewFeed() const {
-        if (!isLoggedIn()) {
-            std::cout << "Please log in to view your feed.\n";
-            return;
+        std::vector<UserId> readers;
+        for (size_t i = 0; i < BENCH_SAMPLES; ++i) {
+            UserId user = static_cast<UserId>(random.below(userCount));
+            PostHandle nextCursor = NO_POST;
+            start = std::chrono::steady_clock::now();
+            app.feedPage(user, FEED_PAGE_SIZE, NO_POST, nextCursor);
+            feed.samples.push_back(elapsedMicros(start));
+            readers.push_back(user);
         }
-
-        std::cout << "--------------------------------\n";
-        std::cout << "Your Social Feed:\n";
-        std::cout << "--------------------------------\n";
-
-        std::vector<std::string> usersInFeed;
-        usersInFeed.push_back(loggedInUser); // Always include own posts in the feed
-
-        // Add friends' usernames to the list of users whose posts should appear in the feed
-        std::map<std::string, std::vector<std::string> >::const_iterator it = friendships.find(loggedInUser); // Added space here
-        if (it != friendships.end()) {
-            for (size_t i = 0; i < it->second.size(); ++i) { // Changed to index-based loop
-                usersInFeed.push_back(it->second[i]);
-            }
+        for (size_t i = 0; i < readers.size(); ++i) { // The same feeds again, now materialized
+            PostHandle nextCursor = NO_POST;
+            start = std::chrono::steady_clock::now();
+            app.feedPage(readers[i], FEED_PAGE_SIZE, NO_POST, nextCursor);
+            cachedFeed.samples.push_back(elapsedMicros(start));
         }
-
-        std::vector<Post> feedPosts;
-        // Collect all relevant posts
-        for (size_t i = 0; i < posts.size(); ++i) { // Changed to index-based loop
-            if (std::find(usersInFeed.begin(), usersInFeed.end(), std::string(posts[i].username)) != usersInFeed.end()) { // Explicitly construct std::string
-                feedPosts.push_back(posts[i]);
-            }
+        for (size_t i = 0; i < 3; ++i) {
+            start = std::chrono::steady_clock::now();
+            app.saveData();
+            save.samples.push_back(elapsedMicros(start));
         }
+    }
 
-        // Sort posts by timestamp in descending order (most recent first)
-        std::sort(feedPosts.begin(), feedPosts.end(), ComparePostsByTimestamp()); // Using custom comparator struct
+    std::printf("%lu users, %lu posts (generated in %.1f ms), data in %s\n", static_cast<unsigned long>(userCount),
+                static_cast<unsigned long>(userCount * BENCH_POSTS_PER_USER), generateMicros / 1000.0, dirName.c_str());
+    std::printf("  %-24s %8s %12s %12s %12s\n", "operation (us)", "samples", "p50", "p99", "max");
+    printBenchSeries(importText);
+    printBenchSeries(loadSnapshot);
+    printBenchSeries(save);
+    printBenchSeries(befriend);
+    printBenchSeries(durableBefriend);
+    printBenchSeries(profile);
+    printBenchSeries(feed);
+    printBenchSeries(cachedFeed);
+    std::printf("  peak RSS so far: %.1f MiB\n\n", peakRssMiB());
+    std::fflush(stdout);
+    return true;
+}
 
-        if (feedPosts.empty()) {
-            std::cout << "No posts in your feed yet. Add friends or post something!\n";
-        } else {
-            for (size_t i = 0; i < feedPosts.size(); ++i) { // Changed to index-based loop
-                feedPosts[i].displayPost();
-            }
+// Runs benchDataset inside BENCH_DIR/<userCount>
+bool runBenchSize(size_t userCount) {
+    std::ostringstream dirName;
+    dirName << BENCH_DIR << "/" << userCount;
+    mkdir(BENCH_DIR, 0755);
+    mkdir(dirName.str().c_str(), 0755);
+    if (chdir(dirName.str().c_str()) != 0) {
+        std::cerr << "Error: Could not enter " << dirName.str() << ".\n";
+        return false;
+    }
+    bool ok = benchDataset(userCount, dirName.str());
+    if (chdir("../..") != 0) {
+        std::cerr << "Error: Could not leave " << dirName.str() << ".\n";
+        return false;
+    }
+    return ok;
+}
+
+// Runs the benchmark for each requested number of users (ascending, so the peak RSS reported
+// after each size belongs to that size)
+int runBenchmarks(std::vector<size_t> sizes) {
+    if (sizes.empty()) {
+        sizes.push_back(1000);
+        sizes.push_back(10000);
+        sizes.push_back(100000);
+    }
+    std::sort(sizes.begin(), sizes.end());
+    for (size_t i = 0; i < sizes.size(); ++i) {
+        if (!runBenchSize(sizes[i])) {
+            return 1;
         }
-        std::cout << "--------------------------------\n";
     }
-};
+    return 0;
+}
+#endif
 
 // --- Main Application Loop ---
 
@@ -529,15 +6675,180 @@ void displayLoggedInMenu() {
     std::cout << "5. Post Message\n";
     std::cout << "6. View Social Feed\n";
     std::cout << "7. Search User Profile\n";
-    std::cout << "8. Logout\n";
+    std::cout << "8. Search Posts\n";
+    std::cout << "9. People You May Know\n";
+    std::cout << "10. Mutual Friends\n";
+    std::cout << "11. Trending Now\n";
+    std::cout << "12. Logout\n";
     std::cout << "Enter choice: ";
 }
 
+// Asks whether to show the next, older page of posts
+bool askShowOlder() {
+    std::string answer;
+    std::cout << "Show older posts? (y/n): ";
+    std::cin >> answer;
+    std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n'); // Clear buffer
+    return answer == "y" || answer == "Y";
+}
+
+// Shows a user's profile and lets the viewer page back through older posts
+void browseProfile(const SocialNetwork& app, const std::string& username) {
+    PostHandle cursor = app.viewProfile(username);
+    while (cursor != NO_POST && askShowOlder()) {
+        cursor = app.viewProfile(username, PROFILE_PAGE_SIZE, cursor);
+    }
+}
+
+// Shows the logged-in user's feed and lets them page back through older posts
+void browseFeed(const SocialNetwork& app) {
+    PostHandle cursor = app.viewFeed();
+    while (cursor != NO_POST && askShowOlder()) {
+        cursor = app.viewFeed(FEED_PAGE_SIZE, cursor);
+    }
+}
+
+// Shows posts matching a search and lets the user page back through older matches
+void browseSearch(const SocialNetwork& app, const std::string& query, bool friendsOnly) {
+    PostHandle cursor = app.viewSearch(query, friendsOnly);
+    while (cursor != NO_POST && askShowOlder()) {
+        cursor = app.viewSearch(query, friendsOnly, FEED_PAGE_SIZE, cursor);
+    }
+}
+
 // Main function where the application execution begins
-int main() {
-    SocialNetwork app; // Create an instance of the SocialNetwork application
+int main(int argc, char* argv[]) {
+    // Options that may precede any mode:
+    //   --stats-json <file>      sample latencies and dump all statistics on exit
+    //   --flush-ms <ms>          how long the journal writer gathers records into one group commit
+    //   --fsync <group|never>    fsync every group commit, or leave flushing to the OS
+    //   --hot-posts <n|all>      how many of the newest posts keep their contents in memory
+    //   --feed-cache <users>     how many users' feeds are kept materialized (0: none)
+    //   --shard <i>/<n>          run shard i of a network split across n processes (see ShardRouter);
+    //                            its files live in the directory shard-<i>
+    PersistenceOptions persistence;
+    while (argc > 2) {
+        std::string name = argv[1];
+        std::string value = argv[2];
+        uint32_t number = 0;
+        if (name == "--stats-json") {
+            instrumentation.jsonFile = value;
+            instrumentation.setSampling(true);
+        } else if (name == "--flush-ms" && !value.empty() && value != "-" && parseNumberArg(value, number)) {
+            persistence.flushIntervalMicros = static_cast<int64_t>(number) * 1000;
+        } else if (name == "--fsync" && (value == "group" || value == "never")) {
+            persistence.fsync = value == "group" ? FSYNC_GROUP : FSYNC_NEVER;
+        } else if (name == "--hot-posts" && value == "all") {
+            persistence.hotPosts = std::numeric_limits<size_t>::max();
+        } else if (name == "--hot-posts" && !value.empty() && value != "-" && parseNumberArg(value, number)) {
+            persistence.hotPosts = number;
+        } else if (name == "--feed-cache" && !value.empty() && value != "-" && parseNumberArg(value, number)) {
+            persistence.feedCacheUsers = number;
+        } else if (name == "--shard" && parseShardArg(value, persistence.shardIndex, persistence.shardCount)) {
+            // Both parts stored by parseShardArg
+        } else if (name == "--flush-ms" || name == "--fsync" || name == "--hot-posts" || name == "--feed-cache"
+                   || name == "--shard") {
+            std::cerr << "Error: Invalid value for " << name << ": " << value << "\n";
+            return 1;
+        } else {
+            break;
+        }
+        argv[2] = argv[0]; // Drop the two arguments, keeping the program name for the usage message
+        argv += 2;
+        argc -= 2;
+    }
+    std::string option = (argc > 1) ? argv[1] : "";
+
+#ifndef _WIN32
+    if (persistence.shardCount > 1) {
+        std::ostringstream dirName;
+        dirName << "shard-" << persistence.shardIndex;
+        mkdir(dirName.str().c_str(), 0755);
+        if (chdir(dirName.str().c_str()) != 0) {
+            std::cerr << "Error: Could not enter " << dirName.str() << ".\n";
+            return 1;
+        }
+    }
+#endif
+
+    // Batch mode: commands from a file (or stdin), results on stdout, progress messages on stderr
+    if (option == "--batch") {
+        SocialNetwork app(std::cerr, persistence);
+        if (argc > 2 && std::string(argv[2]) != "-") {
+            std::ifstream script(argv[2]);
+            if (!script.is_open()) {
+                std::cerr << "Error: Could not open " << argv[2] << ".\n";
+                return 1;
+            }
+            return runBatch(app, script, std::cout);
+        }
+        return runBatch(app, std::cin, std::cout);
+    }
+
+#ifndef _WIN32
+    // Benchmark mode: synthetic datasets of the given numbers of users, timings on stdout
+    if (option == "--bench") {
+        std::vector<size_t> sizes;
+        for (int i = 2; i < argc; ++i) {
+            uint32_t size = 0;
+            if (!parseNumberArg(argv[i], size) || size < 2) {
+                std::cerr << "Usage: " << argv[0] << " --bench [users...]\n";
+                return 1;
+            }
+            sizes.push_back(size);
+        }
+        return runBenchmarks(sizes);
+    }
+#endif
+
+#ifdef __linux__
+    // Server mode: many clients speak the batch protocol concurrently, each after logging in
+    if (option == "--serve") {
+        if (argc < 3) {
+            std::cerr << "Usage: " << argv[0] << " --serve <port | socket path>\n";
+            return 1;
+        }
+        SocialNetwork app(std::cerr, persistence);
+        NetworkCommands commands = { app };
+        Server<NetworkCommands> server(commands, persistence.shardCount > 1); // Shards serve the router
+        size_t workerCount = std::max(2u, std::thread::hardware_concurrency());
+        return server.run(argv[2], workerCount);
+    }
+
+    // Router mode: serves clients like --serve, over the shard servers given in shard order
+    if (option == "--router") {
+        if (argc < 4 || static_cast<size_t>(argc - 3) > (1u << POST_ID_SHARD_BITS)) {
+            std::cerr << "Usage: " << argv[0] << " --router <port | socket path> <shard 0 port | socket path>...\n";
+            return 1;
+        }
+        ShardRouter router(std::vector<std::string>(argv + 3, argv + argc));
+        router.startReconciler();
+        Server<ShardRouter> server(router, false);
+        // Workers mostly wait for shards, so use more of them
+        size_t workerCount = std::max(4u, 2 * std::thread::hardware_concurrency());
+        return server.run(argv[2], workerCount);
+    }
+#endif
+
+    SocialNetwork app(std::cout, persistence); // Create an instance of the SocialNetwork application
     std::string choice;
 
+    // Maintenance options: convert between the binary snapshot and the text files
+    if (!option.empty()) {
+        if (option == "--export-text") {
+            return app.exportTextFiles() ? 0 : 1;
+        } else if (option == "--import-text") {
+            if (!app.importTextFiles()) {
+                std::cerr << "Error: No text files to import; the snapshot was left unchanged.\n";
+                return 1;
+            }
+            app.saveData(); // Replaces the snapshot and the journal with the imported state
+            return 0;
+        }
+        std::cerr << "Usage: " << argv[0] << " [--stats-json <file>] [--flush-ms <ms>] [--fsync <group | never>] [--hot-posts <n | all>] [--feed-cache <users>] [--shard <i>/<n>] [--batch [file] | --serve <port | socket path> | --router <port | socket path> <shards...> | --bench [users...] | --export-text | --import-text]\n";
+        return 1;
+    }
+
     // Main application loop
     while (true) {
         if (!app.isLoggedIn()) {
@@ -564,7 +6875,7 @@ int main() {
             std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n'); // Clear buffer
 
             if (choice == "1") {
-                app.viewProfile(app.getLoggedInUser());
+                browseProfile(app, app.getLoggedInUser());
             } else if (choice == "2") {
                 app.viewFriends(app.getLoggedInUser());
             } else if (choice == "3") {
@@ -574,14 +6885,36 @@ int main() {
             } else if (choice == "5") {
                 app.postMessage();
             } else if (choice == "6") {
-                app.viewFeed();
+                browseFeed(app);
             } else if (choice == "7") {
                 std::string targetUsername;
                 std::cout << "Enter username to search: ";
                 std::cin >> targetUsername;
                 std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n'); // Clear buffer
-                app.viewProfile(targetUsername);
+                browseProfile(app, targetUsername);
             } else if (choice == "8") {
+                std::string query, scope;
+                std::cout << "Enter words to search for (use \"quotes\" for a phrase): ";
+                std::getline(std::cin, query);
+                std::cout << "Search only you and your friends? (y/n): ";
+                std::cin >> scope;
+                std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n'); // Clear buffer
+                browseSearch(app, query, scope == "y" || scope == "Y");
+            } else if (choice == "9") {
+                app.viewSuggestions();
+            } else if (choice == "10") {
+                std::string otherUsername;
+                std::cout << "Enter username to compare with: ";
+                std::cin >> otherUsername;
+                std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n'); // Clear buffer
+                app.viewMutualFriends(otherUsername);
+            } else if (choice == "11") {
+                std::string window;
+                std::cout << "Time window (5m, 1h or 1d): ";
+                std::cin >> window;
+                std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n'); // Clear buffer
+                app.viewTrending(window);
+            } else if (choice == "12") {
                 app.logoutUser();
             } else {
                 std::cout << "Invalid choice. Please try again.\n";